@@ -0,0 +1,119 @@
+#ifndef _GHP_GFX_TEXTURE_FFT_HPP_
+#define _GHP_GFX_TEXTURE_FFT_HPP_
+
+#include "texture.hpp"
+
+#include "../math/fftw.hpp"
+
+#include <algorithm>
+#include <complex>
+#include <limits>
+#include <vector>
+
+#include <cmath>
+
+namespace ghp {
+
+/*
+  Texture filtering through FFTW.  Kept out of gfx.hpp so that only users
+  of these functions need to link FFTW.
+ */
+
+/* store a filtered value in a channel, rounding and clamping for integer
+  channels -- don't use this */
+template<typename T>
+inline T texture_fft_store_(float v) {
+  if(!std::numeric_limits<T>::is_integer) return static_cast<T>(v);
+  const float lo = color_traits<T>::min_value();
+  const float hi = color_traits<T>::max_value();
+  return static_cast<T>(std::min(hi, std::max(lo, std::floor(v + 0.5f))));
+}
+
+/**
+  \brief convolve every channel of a texture with a kernel, using FFTs
+  Costs O(n log n) in the padded image size whatever the kernel size, so
+  it beats direct filtering once kernels grow past a few pixels.  The
+  kernel's center pixel, (kernel_width/2, kernel_height/2), lands on the
+  output pixel, and the source is extended past its borders by repeating
+  the edge pixels, so blurs don't darken the edges.
+  \tparam TEX1 - must support texture concept
+  \tparam TEX2 - must support texture concept
+  \param src - source texture
+  \param kernel - kernel_width*kernel_height weights, row by row
+  \param kernel_width - width of the kernel
+  \param kernel_height - height of the kernel
+  \param dst - receives the filtered texture, resized to src's size; may
+    not be src
+ */
+template<typename TEX1, typename TEX2>
+void convolve_texture_fft(const TEX1 &src, const float *kernel,
+    int kernel_width, int kernel_height, TEX2 &dst) {
+  typedef typename TEX1::pixel_type src_pixel_t;
+  typedef typename TEX2::pixel_type dst_pixel_t;
+  typedef typename dst_pixel_t::value_type dst_value_t;
+  typedef std::complex<float> complex_t;
+
+  const int width = src.width(), height = src.height();
+  dst.resize(width, height);
+  if(width == 0 || height == 0) return;
+
+  // linear convolution fits without wrapping in the padded size, rounded
+  // up to lengths FFTW is fast on; rows are the last (fastest) dimension
+  const int padded_width = fftw::fast_size(width + kernel_width - 1);
+  const int padded_height = fftw::fast_size(height + kernel_height - 1);
+  const int sizes[] = { padded_height, padded_width };
+  const int bins = padded_width/2 + 1;
+  std::vector<float, fftw::simd_alloc<float> > image(
+    padded_width*padded_height);
+  std::vector<complex_t, fftw::simd_alloc<complex_t> > spectrum(
+    bins*padded_height);
+  std::vector<complex_t, fftw::simd_alloc<complex_t> > kernel_spectrum(
+    bins*padded_height);
+  fftw::real_plan<fftwf_complex> forward(2, true, image, spectrum, sizes);
+  fftw::real_plan<fftwf_complex> backward(2, false, spectrum, image, sizes);
+
+  // the inverse transform's 1/n is folded into the kernel
+  const float scale = 1.0f / (padded_width*padded_height);
+  std::fill(image.begin(), image.end(), 0.0f);
+  for(int y=0; y<kernel_height; ++y) {
+    for(int x=0; x<kernel_width; ++x) {
+      image[y*padded_width + x] = kernel[y*kernel_width + x] * scale;
+    }
+  }
+  forward();
+  kernel_spectrum = spectrum;
+
+  // padded pixel (u, v) holds source pixel (u - ox, v - oy), clamped;
+  // output pixel (x, y) is then padded pixel (x + kernel_width - 1, ...)
+  const int ox = kernel_width - 1 - kernel_width/2;
+  const int oy = kernel_height - 1 - kernel_height/2;
+  const int channels = std::min<int>(src_pixel_t::num_channels,
+    dst_pixel_t::num_channels);
+  for(int c=0; c<channels; ++c) {
+    for(int v=0; v<padded_height; ++v) {
+      const int sy = std::min(height - 1, std::max(0, v - oy));
+      float *row = &image[v*padded_width];
+      for(int u=0; u<padded_width; ++u) {
+        const int sx = std::min(width - 1, std::max(0, u - ox));
+        row[u] = static_cast<float>(src(sx, sy)[c]);
+      }
+    }
+    forward();
+    for(std::size_t i=0; i<spectrum.size(); ++i) {
+      spectrum[i] *= kernel_spectrum[i];
+    }
+    backward();
+    for(int y=0; y<height; ++y) {
+      const float *row =
+        &image[(y + kernel_height - 1)*padded_width + kernel_width - 1];
+      for(int x=0; x<width; ++x) {
+        dst(x, y)[c] = texture_fft_store_<dst_value_t>(row[x]);
+      }
+    }
+  }
+}
+
+}
+
+#endif
+
@@ -1,9 +1,22 @@
 #ifndef _GHP_MATH_HPP_
 #define _GHP_MATH_HPP_
 
+#include "math/convex_hull.hpp"
+#include "math/half_edge.hpp"
 #include "math/interpolate.hpp"
+#include "math/marching_cubes.hpp"
 #include "math/mesh.hpp"
+#include "math/mesh_binary.hpp"
+#include "math/mesh_formats.hpp"
+#include "math/mesh_normals.hpp"
+#include "math/mesh_optimize.hpp"
+#include "math/mesh_simplify.hpp"
+#include "math/mesh_storage.hpp"
+#include "math/mesh_stream.hpp"
 #include "math/mesh_util.hpp"
+#include "math/meshlet.hpp"
+#include "math/obj_parser.hpp"
+#include "math/obj_writer.hpp"
 #include "math/rot_complex.hpp"
 #include "math/rot_euler.hpp"
 #include "math/rot_matrix.hpp"
@@ -12,9 +25,11 @@
 #include "math/signum.hpp"
 #include "math/spatial.hpp"
 #include "math/spatial_common.hpp"
+#include "math/subdivision.hpp"
 #include "math/vector.hpp"
 #include "math/vertex.hpp"
 #include "math/vertex_aux.hpp"
+#include "math/vertex_quantized.hpp"
 
 #endif
 
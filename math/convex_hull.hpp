@@ -0,0 +1,556 @@
+#ifndef _GHP_MATH_CONVEX_HULL_HPP_
+#define _GHP_MATH_CONVEX_HULL_HPP_
+
+#include "vector.hpp"
+#include "vertex_aux.hpp"
+#include "../util/parallel.hpp"
+
+#include <algorithm>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include <cfloat>
+#include <cmath>
+
+namespace ghp {
+
+/* cross product -- don't use this function */
+inline vector<3, float> hull_cross_(const vector<3, float> &a,
+    const vector<3, float> &b) {
+  return vector3<float>(a(1)*b(2) - a(2)*b(1), a(2)*b(0) - a(0)*b(2),
+    a(0)*b(1) - a(1)*b(0));
+}
+
+/* unit normal and offset of the plane through a, b, c, in double: hull
+  faces can be slivers whose float normals point anywhere -- don't use
+  this function */
+inline void hull_plane_(const vector<3, float> &a, const vector<3, float> &b,
+    const vector<3, float> &c, double normal[3], double &offset) {
+  const double u[3] = { double(b(0)) - a(0), double(b(1)) - a(1),
+    double(b(2)) - a(2) };
+  const double v[3] = { double(c(0)) - a(0), double(c(1)) - a(1),
+    double(c(2)) - a(2) };
+  normal[0] = u[1]*v[2] - u[2]*v[1];
+  normal[1] = u[2]*v[0] - u[0]*v[2];
+  normal[2] = u[0]*v[1] - u[1]*v[0];
+  const double len2 = normal[0]*normal[0] + normal[1]*normal[1]
+    + normal[2]*normal[2];
+  if(len2 > 0) {
+    const double len = std::sqrt(len2);
+    for(int k=0; k<3; ++k) normal[k] /= len;
+  }
+  offset = normal[0]*a(0) + normal[1]*a(1) + normal[2]*a(2);
+}
+
+/* signed distance of p above a plane -- don't use this function */
+inline double hull_distance_(const double normal[3], double offset,
+    const vector<3, float> &p) {
+  return normal[0]*p(0) + normal[1]*p(1) + normal[2]*p(2) - offset;
+}
+
+/* per-block search for the point farthest from a line (b - a != 0) or,
+  with a plane normal, from a plane -- don't use this */
+struct hull_farthest_ {
+  hull_farthest_(const vector<3, float> *points, std::size_t blocks)
+    : points_(points), best_(blocks, -1), best_dist_(blocks, -1),
+      plane_(false) { }
+
+  void operator()(std::size_t block, std::size_t begin, std::size_t end) {
+    int best = -1;
+    float best_dist = -1;
+    for(std::size_t i=begin; i<end; ++i) {
+      const vector<3, float> d = points_[i] - a_;
+      const float dist = plane_ ? std::fabs(inner_prod(d, dir_))
+        : hull_cross_(d, dir_).norm2();
+      if(dist > best_dist) {
+        best = i;
+        best_dist = dist;
+      }
+    }
+    best_[block] = best;
+    best_dist_[block] = best_dist;
+  }
+
+  int result() const {
+    int best = -1;
+    float best_dist = -1;
+    for(std::size_t b=0; b<best_.size(); ++b) {
+      if(best_dist_[b] > best_dist) {
+        best = best_[b];
+        best_dist = best_dist_[b];
+      }
+    }
+    return best;
+  }
+
+  const vector<3, float> *points_;
+  std::vector<int> best_;
+  std::vector<float> best_dist_;
+  vector<3, float> a_;
+  vector<3, float> dir_;
+  bool plane_;
+};
+
+/* per-block extreme points along each axis -- don't use this */
+struct hull_extremes_ {
+  hull_extremes_(const vector<3, float> *points, std::size_t blocks)
+    : points_(points), extremes_(6*blocks, 0) { }
+
+  void operator()(std::size_t block, std::size_t begin, std::size_t end) {
+    int *e = &extremes_[6*block];
+    for(int k=0; k<6; ++k) e[k] = begin;
+    for(std::size_t i=begin; i<end; ++i) {
+      for(int k=0; k<3; ++k) {
+        if(points_[i](k) < points_[e[2*k]](k)) e[2*k] = i;
+        if(points_[i](k) > points_[e[2*k + 1]](k)) e[2*k + 1] = i;
+      }
+    }
+  }
+
+  const vector<3, float> *points_;
+  std::vector<int> extremes_;
+};
+
+/* initial assignment of points to the faces of the starting simplex --
+  don't use this */
+struct hull_partition_ {
+  hull_partition_(const vector<3, float> *points, const double (*n)[3],
+      const double *d, double eps, std::vector<signed char> &face,
+      std::vector<double> &dist)
+    : points_(points), n_(n), d_(d), eps_(eps), face_(face), dist_(dist) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    for(std::size_t i=begin; i<end; ++i) {
+      face_[i] = -1;
+      for(int f=0; f<4; ++f) {
+        const double dist = hull_distance_(n_[f], d_[f], points_[i]);
+        if(dist > eps_) {
+          face_[i] = f;
+          dist_[i] = dist;
+          break;
+        }
+      }
+    }
+  }
+
+  const vector<3, float> *points_;
+  const double (*n_)[3];
+  const double *d_;
+  double eps_;
+  std::vector<signed char> &face_;
+  std::vector<double> &dist_;
+};
+
+/* incremental quickhull state -- don't use this */
+class quickhull_ {
+public:
+  quickhull_(const vector<3, float> *points, std::size_t n)
+    : points_(points), n_(n), next_(n, -1), stamp_(0), num_vertices_(0) { }
+
+  /* build the hull; false if the points don't span three dimensions */
+  bool run(int max_vertices, unsigned threads) {
+    const std::size_t min_block = 1 << 14;
+    if(n_ < 4) return false;
+
+    // starting simplex from the extreme points
+    const std::size_t blocks = parallel_num_blocks(n_, min_block, threads);
+    hull_extremes_ extremes(points_, blocks);
+    parallel_for_blocks(0, n_, extremes, min_block, threads);
+    int ext[6];
+    for(int k=0; k<6; ++k) ext[k] = extremes.extremes_[k];
+    for(std::size_t b=1; b<blocks; ++b) {
+      const int *e = &extremes.extremes_[6*b];
+      for(int k=0; k<3; ++k) {
+        if(points_[e[2*k]](k) < points_[ext[2*k]](k)) ext[2*k] = e[2*k];
+        if(points_[e[2*k + 1]](k) > points_[ext[2*k + 1]](k)) {
+          ext[2*k + 1] = e[2*k + 1];
+        }
+      }
+    }
+    float extent = 0;
+    int axis = 0;
+    for(int k=0; k<3; ++k) {
+      const float size = points_[ext[2*k + 1]](k) - points_[ext[2*k]](k);
+      extent += std::max(std::fabs(points_[ext[2*k]](k)),
+        std::fabs(points_[ext[2*k + 1]](k)));
+      if(size > points_[ext[2*axis + 1]](axis) - points_[ext[2*axis]](axis)) {
+        axis = k;
+      }
+    }
+    eps_ = 3 * FLT_EPSILON * extent;
+    const int v0 = ext[2*axis], v1 = ext[2*axis + 1];
+    if(v0 == v1) return false;
+
+    hull_farthest_ farthest(points_, blocks);
+    farthest.a_ = points_[v0];
+    farthest.dir_ = points_[v1] - points_[v0];
+    parallel_for_blocks(0, n_, farthest, min_block, threads);
+    const int v2 = farthest.result();
+    const vector<3, float> normal = hull_cross_(points_[v1] - points_[v0],
+      points_[v2] - points_[v0]);
+    if(normal.norm2() <= eps_*eps_*eps_*eps_) return false;
+    farthest.dir_ = normal / std::sqrt(normal.norm2());
+    farthest.plane_ = true;
+    parallel_for_blocks(0, n_, farthest, min_block, threads);
+    int v3 = farthest.result();
+    float side = inner_prod(points_[v3] - points_[v0], farthest.dir_);
+    if(std::fabs(side) <= eps_) return false;
+
+    // four outward facing triangles, with v3 above the first's plane
+    // flipped if needed
+    int tri[4][3] = { { v0, v1, v2 }, { v0, v3, v1 }, { v1, v3, v2 },
+      { v2, v3, v0 } };
+    if(side > 0) {
+      for(int f=0; f<4; ++f) std::swap(tri[f][1], tri[f][2]);
+    }
+    int ids[4];
+    for(int f=0; f<4; ++f) ids[f] = new_face_(tri[f][0], tri[f][1], tri[f][2]);
+    for(int f=0; f<4; ++f) {
+      for(int k=0; k<3; ++k) {
+        const int a = tri[f][k], b = tri[f][(k + 1) % 3];
+        for(int g=0; g<4; ++g) {
+          for(int j=0; j<3; ++j) {
+            if(tri[g][j] == b && tri[g][(j + 1) % 3] == a) {
+              faces_[ids[f]].neighbor[k] = ids[g];
+            }
+          }
+        }
+      }
+    }
+    num_vertices_ = 4;
+
+    // partition the points among the four faces in parallel, then link
+    // each face's outside set
+    double n[4][3];
+    double d[4];
+    for(int f=0; f<4; ++f) {
+      for(int k=0; k<3; ++k) n[f][k] = faces_[ids[f]].normal[k];
+      d[f] = faces_[ids[f]].offset;
+    }
+    std::vector<signed char> assigned(n_);
+    std::vector<double> dist(n_);
+    hull_partition_ partition(points_, n, d, eps_, assigned, dist);
+    parallel_for_blocks(0, n_, partition, min_block, threads);
+    for(std::size_t i=0; i<n_; ++i) {
+      if(assigned[i] < 0 || static_cast<int>(i) == v0
+          || static_cast<int>(i) == v1 || static_cast<int>(i) == v2
+          || static_cast<int>(i) == v3) {
+        continue;
+      }
+      add_outside_(ids[assigned[i]], i, dist[i]);
+    }
+    for(int f=0; f<4; ++f) push_(ids[f]);
+
+    // repeatedly add the point farthest outside any face
+    while(!queue_.empty()) {
+      if(max_vertices > 0 && num_vertices_ >= max_vertices) break;
+      const queue_entry_ top = queue_.top();
+      queue_.pop();
+      const hull_face_ &face = faces_[top.second];
+      if(!face.alive || face.furthest < 0
+          || face.furthest_dist != top.first) {
+        continue; // stale
+      }
+      add_point_(top.second, face.furthest);
+    }
+    return true;
+  }
+
+  /* surviving faces as index triples */
+  void triangles(std::vector<int> &out) const {
+    out.clear();
+    for(std::size_t f=0; f<faces_.size(); ++f) {
+      if(!faces_[f].alive) continue;
+      for(int k=0; k<3; ++k) out.push_back(faces_[f].v[k]);
+    }
+  }
+
+private:
+  struct hull_face_ {
+    int v[3];
+    int neighbor[3];
+    double normal[3];
+    double offset;
+    int outside;
+    int furthest;
+    double furthest_dist;
+    unsigned visited;
+    bool visible;
+    bool alive;
+  };
+  struct hull_frame_ {
+    int face;
+    int edge;
+    int remaining;
+  };
+  typedef std::pair<double, int> queue_entry_;
+
+  inline double distance_(const hull_face_ &f, int p) const {
+    return hull_distance_(f.normal, f.offset, points_[p]);
+  }
+
+  // faces come from a pool; dead ones are reused before growing it
+  int new_face_(int a, int b, int c) {
+    int id;
+    if(!free_.empty()) {
+      id = free_.back();
+      free_.pop_back();
+    } else {
+      id = faces_.size();
+      faces_.push_back(hull_face_());
+    }
+    hull_face_ &f = faces_[id];
+    f.v[0] = a;
+    f.v[1] = b;
+    f.v[2] = c;
+    f.neighbor[0] = f.neighbor[1] = f.neighbor[2] = -1;
+    hull_plane_(points_[a], points_[b], points_[c], f.normal, f.offset);
+    f.outside = -1;
+    f.furthest = -1;
+    f.furthest_dist = 0;
+    f.visited = 0;
+    f.visible = false;
+    f.alive = true;
+    return id;
+  }
+
+  void add_outside_(int f, int p, double dist) {
+    hull_face_ &face = faces_[f];
+    next_[p] = face.outside;
+    face.outside = p;
+    if(dist > face.furthest_dist) {
+      face.furthest = p;
+      face.furthest_dist = dist;
+    }
+  }
+
+  // remove p from f's outside set and requeue f for its next furthest
+  void discard_(int f, int p) {
+    hull_face_ &face = faces_[f];
+    face.furthest = -1;
+    face.furthest_dist = 0;
+    int *link = &face.outside;
+    while(*link >= 0) {
+      const int q = *link;
+      if(q == p) {
+        *link = next_[q];
+        continue;
+      }
+      const double dist = distance_(face, q);
+      if(dist > face.furthest_dist) {
+        face.furthest = q;
+        face.furthest_dist = dist;
+      }
+      link = &next_[q];
+    }
+    push_(f);
+  }
+
+  void push_(int f) {
+    if(faces_[f].furthest >= 0) {
+      queue_.push(queue_entry_(faces_[f].furthest_dist, f));
+    }
+  }
+
+  // find the faces eye is above by more than threshold with a depth
+  // first walk; visiting each face's edges starting after the one it was
+  // entered by yields the horizon as one counter-clockwise loop.  false
+  // if rounding left the visible faces something other than a disc
+  bool find_horizon_(int start, int eye, double threshold) {
+    ++stamp_;
+    horizon_.clear();
+    visible_.clear();
+    stack_.clear();
+    faces_[start].visited = stamp_;
+    faces_[start].visible = true;
+    visible_.push_back(start);
+    const hull_frame_ first = { start, 0, 3 };
+    stack_.push_back(first);
+    while(!stack_.empty()) {
+      hull_frame_ &top = stack_.back();
+      if(top.remaining == 0) {
+        stack_.pop_back();
+        continue;
+      }
+      const int f = top.face;
+      const int k = top.edge;
+      top.edge = (top.edge + 1) % 3;
+      --top.remaining;
+      const int g = faces_[f].neighbor[k];
+      hull_face_ &other = faces_[g];
+      if(other.visited != stamp_) {
+        other.visited = stamp_;
+        other.visible = distance_(other, eye) > threshold;
+        if(other.visible) {
+          visible_.push_back(g);
+          int back = 0;
+          while(other.neighbor[back] != f) ++back;
+          // the shared edge is interior to the visible region
+          const hull_frame_ next = { g, (back + 1) % 3, 2 };
+          stack_.push_back(next);
+          continue;
+        }
+      }
+      if(!other.visible) horizon_.push_back(std::make_pair(f, k));
+    }
+
+    const std::size_t h = horizon_.size();
+    if(h < 3) return false;
+    for(std::size_t i=0; i<h; ++i) {
+      const hull_face_ &f = faces_[horizon_[i].first];
+      const hull_face_ &g = faces_[horizon_[(i + 1) % h].first];
+      if(f.v[(horizon_[i].second + 1) % 3]
+          != g.v[horizon_[(i + 1) % h].second]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void add_point_(int start, int eye) {
+    // every face eye is above goes, even by less than eps_: keeping one
+    // would join it to a new face at a reflex edge, and a new face that
+    // is nearly a sliver then tilts far out of the hull.  Only if
+    // rounding breaks the visible region up are near-coplanar faces
+    // kept instead, and if even that region isn't a disc eye is treated
+    // as on the hull and dropped, leaving the faces untouched
+    if(!find_horizon_(start, eye, 0) && !find_horizon_(start, eye, eps_)) {
+      discard_(start, eye);
+      return;
+    }
+
+    // one new face per horizon edge, fanning out from eye
+    const std::size_t h = horizon_.size();
+    new_faces_.resize(h);
+    for(std::size_t i=0; i<h; ++i) {
+      const hull_face_ &f = faces_[horizon_[i].first];
+      const int k = horizon_[i].second;
+      const int a = f.v[k], b = f.v[(k + 1) % 3];
+      const int across = f.neighbor[k];
+      const int id = new_face_(a, b, eye);
+      new_faces_[i] = id;
+      faces_[id].neighbor[0] = across;
+      hull_face_ &other = faces_[across];
+      for(int j=0; j<3; ++j) {
+        if(other.neighbor[j] == horizon_[i].first
+            && other.v[j] == b) {
+          other.neighbor[j] = id;
+        }
+      }
+    }
+    for(std::size_t i=0; i<h; ++i) {
+      const int next = new_faces_[(i + 1) % h];
+      faces_[new_faces_[i]].neighbor[1] = next;
+      faces_[next].neighbor[2] = new_faces_[i];
+    }
+    ++num_vertices_;
+
+    // hand the visible faces' outside points to the new faces; points
+    // above none of them are now inside the hull
+    for(std::size_t i=0; i<visible_.size(); ++i) {
+      hull_face_ &f = faces_[visible_[i]];
+      f.alive = false;
+      for(int p=f.outside; p>=0; ) {
+        const int next = next_[p];
+        if(p != eye) {
+          for(std::size_t j=0; j<h; ++j) {
+            const double dist = distance_(faces_[new_faces_[j]], p);
+            if(dist > eps_) {
+              add_outside_(new_faces_[j], p, dist);
+              break;
+            }
+          }
+        }
+        p = next;
+      }
+      f.outside = -1;
+      free_.push_back(visible_[i]);
+    }
+    for(std::size_t i=0; i<h; ++i) push_(new_faces_[i]);
+  }
+
+  const vector<3, float> *points_;
+  std::size_t n_;
+  double eps_;
+  std::vector<hull_face_> faces_;
+  std::vector<int> free_;
+  std::vector<int> next_;
+  std::priority_queue<queue_entry_> queue_;
+  unsigned stamp_;
+  int num_vertices_;
+  std::vector<std::pair<int, int> > horizon_;
+  std::vector<int> visible_;
+  std::vector<int> new_faces_;
+  std::vector<hull_frame_> stack_;
+};
+
+/**
+  \brief convex hull of a point set, by quickhull
+  Starts from a tetrahedron of extreme points and repeatedly adds the
+  point farthest outside the hull, replacing the faces it can see with
+  a fan to their horizon.  The extreme point searches and the initial
+  partitioning of points among the tetrahedron's faces, which touch
+  every point, run in parallel; later steps only revisit the outside
+  points of replaced faces.  Faces live in a pool and outside sets are
+  intrusive lists, so nothing is allocated per face or per point.
+  Face planes are computed in double, and a new point removes every face
+  it is above, however slightly, so the hull stays convex: no input point
+  ends up above any face by more than a few float roundings of the
+  coordinates' magnitude.
+  With max_vertices the hull stops growing once it has that many
+  vertices; since points are added farthest first, the result is a good
+  simplified hull, though it no longer contains every point.
+  \param points - point array
+  \param n - number of points
+  \param triangles - receives outward facing triangles, three indices
+    into points each; empty if the points don't span three dimensions
+  \param max_vertices - vertex limit for a simplified hull, 0 for none
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+ */
+inline void convex_hull(const vector<3, float> *points, std::size_t n,
+    std::vector<int> &triangles, int max_vertices = 0,
+    unsigned threads = 0) {
+  triangles.clear();
+  quickhull_ hull(points, n);
+  if(hull.run(max_vertices, threads)) hull.triangles(triangles);
+}
+
+/**
+  \brief convex hull of a point set, as a mesh
+  See convex_hull.  Only hull points become vertices; their normals are
+  left for e.g. compute_smooth_normals.
+  \tparam M - supports mesh concept
+  \param points - point array
+  \param n - number of points
+  \param m - receives the hull
+  \param max_vertices - vertex limit for a simplified hull, 0 for none
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+ */
+template<typename M>
+void convex_hull_mesh(const vector<3, float> *points, std::size_t n, M &m,
+    int max_vertices = 0, unsigned threads = 0) {
+  typedef typename M::vertex_access_t access_t;
+  std::vector<int> triangles;
+  convex_hull(points, n, triangles, max_vertices, threads);
+  std::vector<int> sources(triangles);
+  std::sort(sources.begin(), sources.end());
+  sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+
+  m.resize_vertices(sources.size());
+  for(std::size_t i=0; i<sources.size(); ++i) {
+    vertex_write_loc<access_t>()(m.vertices(i), points[sources[i]]);
+  }
+  m.resize_faces(triangles.size() / 3);
+  for(std::size_t f=0; f<triangles.size() / 3; ++f) {
+    for(int v=0; v<3; ++v) {
+      m.faces(f)[v] = std::lower_bound(sources.begin(), sources.end(),
+        triangles[3*f + v]) - sources.begin();
+    }
+  }
+}
+
+}
+
+#endif
+
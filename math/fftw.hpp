@@ -3,6 +3,7 @@
 
 #include "../util.hpp"
 
+#include <boost/noncopyable.hpp>
 #include <boost/thread.hpp>
 
 #include <fftw3.h>
@@ -13,6 +14,8 @@
 #include <cstring>
 #include <iostream>
 #include <map>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 namespace fftw {
@@ -22,9 +25,12 @@ namespace fftw {
     1) an allocator is provided for creating containers with 
       SIMD-aligned contents
     2) an plan object is provided to create FFTW plans and 
-      perform DFTs
+      perform DFTs; plans are shared through a process-wide cache
     3) a number of MATLAB-like convenience methods are provided
-      for performing DFTs with transient plans
+      for performing DFTs with cached plans
+
+  Define GHP_FFTW_THREADS, and link FFTW's threads libraries, to let
+  large transforms use several threads.
  */
 
 /** \brief C++ allocator for SIMD-aligned memory
@@ -107,10 +113,95 @@ template<> struct cpp2fftw<std::complex<long double> > {
   typedef fftwl_complex value_type;
 };
 
+/** \brief FFTW complex type with the same precision as a real type */
+template<typename T> struct real2fftw { };
+template<> struct real2fftw<float> {
+  typedef fftwf_complex value_type;
+};
+template<> struct real2fftw<double> {
+  typedef fftw_complex value_type;
+};
+
+/** \brief how hard FFTW's planner looks for a fast algorithm
+  Each level takes longer to plan than the one before and usually runs a
+  little faster; wisdom_only never plans and fails unless wisdom for the
+  transform has been imported. */
+enum planner_effort {
+  estimate,
+  measure,
+  patient,
+  exhaustive,
+  wisdom_only
+};
+
+/* don't use these */
+inline unsigned planner_flags_(planner_effort effort) {
+  switch(effort) {
+  case estimate: return FFTW_ESTIMATE;
+  case patient: return FFTW_PATIENT;
+  case exhaustive: return FFTW_EXHAUSTIVE;
+  case wisdom_only: return FFTW_WISDOM_ONLY;
+  default: return FFTW_MEASURE;
+  }
+}
+template<int N=0> struct planner_defaults_ {
+  static planner_effort effort;
+};
+template<int N> planner_effort planner_defaults_<N>::effort = measure;
+
+/** \brief planner effort used when none is given, e.g. by fft() and
+  conv(); measure unless changed.  Set it before planning starts. */
+inline planner_effort default_planner_effort() {
+  return planner_defaults_<>::effort;
+}
+/** \brief change the planner effort used when none is given */
+inline void set_default_planner_effort(planner_effort effort) {
+  planner_defaults_<>::effort = effort;
+}
+
+template<int N=0> struct thread_defaults_ {
+  static unsigned threads;
+  static std::size_t threshold;
+};
+template<int N> unsigned thread_defaults_<N>::threads = 0;
+template<int N> std::size_t thread_defaults_<N>::threshold = 1 << 16;
+
+/** \brief number of threads plans use when none is given; 0, the
+  default, picks automatically.  Threads are only used when compiled
+  with GHP_FFTW_THREADS defined (and linked with FFTW's threads
+  libraries).  Set it before planning starts. */
+inline void set_default_threads(unsigned threads) {
+  thread_defaults_<>::threads = threads;
+}
+/** \brief when picking automatically, transforms of at least this many
+  samples use hardware_threads() threads, smaller ones a single thread,
+  where threading costs more than it saves */
+inline void set_threading_threshold(std::size_t samples) {
+  thread_defaults_<>::threshold = samples;
+}
+
+/* threads a transform of the given size is planned with -- don't use
+  this */
+inline int plan_threads_(unsigned requested, std::size_t samples) {
+#ifdef GHP_FFTW_THREADS
+  if(requested == 0) requested = thread_defaults_<>::threads;
+  if(requested == 0) {
+    requested = samples >= thread_defaults_<>::threshold
+      ? ghp::hardware_threads() : 1;
+  }
+  return requested;
+#else
+  (void)requested;
+  (void)samples;
+  return 1;
+#endif
+}
+
 template<typename T, int N=0> struct fftw_type_traits { };
 template<int N> struct fftw_type_traits<fftwf_complex, N> {
   typedef fftwf_plan plan_type;
   typedef fftwf_complex complex_type;
+  typedef float real_type;
 
   static inline plan_type create_plan(
       int dim,
@@ -118,10 +209,92 @@ template<int N> struct fftw_type_traits<fftwf_complex, N> {
       complex_type *in,
       complex_type *out,
       int sign,
-      unsigned flags) {
+      unsigned flags,
+      int threads = 1) {
     boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
     return fftwf_plan_dft(dim, sizes, in, out, sign, flags);
   }
+  static inline plan_type create_plan(
+      int dim,
+      const int *sizes,
+      real_type *in,
+      complex_type *out,
+      unsigned flags,
+      int threads = 1) {
+    boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
+    return fftwf_plan_dft_r2c(dim, sizes, in, out, flags);
+  }
+  static inline plan_type create_plan(
+      int dim,
+      const int *sizes,
+      complex_type *in,
+      real_type *out,
+      unsigned flags,
+      int threads = 1) {
+    boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
+    return fftwf_plan_dft_c2r(dim, sizes, in, out, flags);
+  }
+  static inline plan_type create_plan_many(
+      int dim,
+      const int *sizes,
+      int howmany,
+      complex_type *in,
+      const int *inembed,
+      int istride,
+      int idist,
+      complex_type *out,
+      const int *onembed,
+      int ostride,
+      int odist,
+      int sign,
+      unsigned flags,
+      int threads = 1) {
+    boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
+    return fftwf_plan_many_dft(dim, sizes, howmany, in, inembed, istride,
+      idist, out, onembed, ostride, odist, sign, flags);
+  }
+  static inline plan_type create_plan_many(
+      int dim,
+      const int *sizes,
+      int howmany,
+      real_type *in,
+      const int *inembed,
+      int istride,
+      int idist,
+      complex_type *out,
+      const int *onembed,
+      int ostride,
+      int odist,
+      unsigned flags,
+      int threads = 1) {
+    boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
+    return fftwf_plan_many_dft_r2c(dim, sizes, howmany, in, inembed,
+      istride, idist, out, onembed, ostride, odist, flags);
+  }
+  static inline plan_type create_plan_many(
+      int dim,
+      const int *sizes,
+      int howmany,
+      complex_type *in,
+      const int *inembed,
+      int istride,
+      int idist,
+      real_type *out,
+      const int *onembed,
+      int ostride,
+      int odist,
+      unsigned flags,
+      int threads = 1) {
+    boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
+    return fftwf_plan_many_dft_c2r(dim, sizes, howmany, in, inembed,
+      istride, idist, out, onembed, ostride, odist, flags);
+  }
   static inline void destroy_plan(plan_type plan) {
     boost::mutex::scoped_lock lock(mutex_);
     fftwf_destroy_plan(plan);
@@ -129,8 +302,50 @@ template<int N> struct fftw_type_traits<fftwf_complex, N> {
   static inline void execute_plan(plan_type plan) {
     fftwf_execute(plan);
   }
+  static inline void execute_plan(plan_type plan, complex_type *in,
+      complex_type *out) {
+    fftwf_execute_dft(plan, in, out);
+  }
+  static inline void execute_plan(plan_type plan, real_type *in,
+      complex_type *out) {
+    fftwf_execute_dft_r2c(plan, in, out);
+  }
+  static inline void execute_plan(plan_type plan, complex_type *in,
+      real_type *out) {
+    fftwf_execute_dft_c2r(plan, in, out);
+  }
+  static inline int alignment_of(complex_type *p) {
+    return fftwf_alignment_of(reinterpret_cast<float*>(p));
+  }
+  static inline int alignment_of(real_type *p) {
+    return fftwf_alignment_of(p);
+  }
+  static inline bool import_wisdom(const char *path) {
+    boost::mutex::scoped_lock lock(mutex_);
+    return fftwf_import_wisdom_from_filename(path) != 0;
+  }
+  static inline bool export_wisdom(const char *path) {
+    boost::mutex::scoped_lock lock(mutex_);
+    return fftwf_export_wisdom_to_filename(path) != 0;
+  }
 
 private:
+  // mutex_ must be held
+  static inline void use_threads_(int threads) {
+#ifdef GHP_FFTW_THREADS
+    static bool initialized = false;
+    if(!initialized) {
+      if(!fftwf_init_threads()) {
+        throw std::runtime_error("couldn't initialize FFTW threads");
+      }
+      initialized = true;
+    }
+    fftwf_plan_with_nthreads(threads);
+#else
+    (void)threads;
+#endif
+  }
+
   static boost::mutex mutex_;
 };
 template<int N> boost::mutex fftw_type_traits<fftwf_complex, N>::mutex_;
@@ -138,6 +353,7 @@ template<int N> boost::mutex fftw_type_traits<fftwf_complex, N>::mutex_;
 template<int N> struct fftw_type_traits<fftw_complex, N> {
   typedef fftw_plan plan_type;
   typedef fftw_complex complex_type;
+  typedef double real_type;
 
   static inline plan_type create_plan(
       int dim,
@@ -145,10 +361,92 @@ template<int N> struct fftw_type_traits<fftw_complex, N> {
       complex_type *in,
       complex_type *out,
       int sign,
-      unsigned flags) {
+      unsigned flags,
+      int threads = 1) {
     boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
     return fftw_plan_dft(dim, sizes, in, out, sign, flags);
   }
+  static inline plan_type create_plan(
+      int dim,
+      const int *sizes,
+      real_type *in,
+      complex_type *out,
+      unsigned flags,
+      int threads = 1) {
+    boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
+    return fftw_plan_dft_r2c(dim, sizes, in, out, flags);
+  }
+  static inline plan_type create_plan(
+      int dim,
+      const int *sizes,
+      complex_type *in,
+      real_type *out,
+      unsigned flags,
+      int threads = 1) {
+    boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
+    return fftw_plan_dft_c2r(dim, sizes, in, out, flags);
+  }
+  static inline plan_type create_plan_many(
+      int dim,
+      const int *sizes,
+      int howmany,
+      complex_type *in,
+      const int *inembed,
+      int istride,
+      int idist,
+      complex_type *out,
+      const int *onembed,
+      int ostride,
+      int odist,
+      int sign,
+      unsigned flags,
+      int threads = 1) {
+    boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
+    return fftw_plan_many_dft(dim, sizes, howmany, in, inembed, istride,
+      idist, out, onembed, ostride, odist, sign, flags);
+  }
+  static inline plan_type create_plan_many(
+      int dim,
+      const int *sizes,
+      int howmany,
+      real_type *in,
+      const int *inembed,
+      int istride,
+      int idist,
+      complex_type *out,
+      const int *onembed,
+      int ostride,
+      int odist,
+      unsigned flags,
+      int threads = 1) {
+    boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
+    return fftw_plan_many_dft_r2c(dim, sizes, howmany, in, inembed,
+      istride, idist, out, onembed, ostride, odist, flags);
+  }
+  static inline plan_type create_plan_many(
+      int dim,
+      const int *sizes,
+      int howmany,
+      complex_type *in,
+      const int *inembed,
+      int istride,
+      int idist,
+      real_type *out,
+      const int *onembed,
+      int ostride,
+      int odist,
+      unsigned flags,
+      int threads = 1) {
+    boost::mutex::scoped_lock lock(mutex_);
+    use_threads_(threads);
+    return fftw_plan_many_dft_c2r(dim, sizes, howmany, in, inembed,
+      istride, idist, out, onembed, ostride, odist, flags);
+  }
   static inline void destroy_plan(plan_type plan) {
     boost::mutex::scoped_lock lock(mutex_);
     fftw_destroy_plan(plan);
@@ -156,8 +454,50 @@ template<int N> struct fftw_type_traits<fftw_complex, N> {
   static inline void execute_plan(plan_type plan) {
     fftw_execute(plan);
   }
+  static inline void execute_plan(plan_type plan, complex_type *in,
+      complex_type *out) {
+    fftw_execute_dft(plan, in, out);
+  }
+  static inline void execute_plan(plan_type plan, real_type *in,
+      complex_type *out) {
+    fftw_execute_dft_r2c(plan, in, out);
+  }
+  static inline void execute_plan(plan_type plan, complex_type *in,
+      real_type *out) {
+    fftw_execute_dft_c2r(plan, in, out);
+  }
+  static inline int alignment_of(complex_type *p) {
+    return fftw_alignment_of(reinterpret_cast<double*>(p));
+  }
+  static inline int alignment_of(real_type *p) {
+    return fftw_alignment_of(p);
+  }
+  static inline bool import_wisdom(const char *path) {
+    boost::mutex::scoped_lock lock(mutex_);
+    return fftw_import_wisdom_from_filename(path) != 0;
+  }
+  static inline bool export_wisdom(const char *path) {
+    boost::mutex::scoped_lock lock(mutex_);
+    return fftw_export_wisdom_to_filename(path) != 0;
+  }
 
 private:
+  // mutex_ must be held
+  static inline void use_threads_(int threads) {
+#ifdef GHP_FFTW_THREADS
+    static bool initialized = false;
+    if(!initialized) {
+      if(!fftw_init_threads()) {
+        throw std::runtime_error("couldn't initialize FFTW threads");
+      }
+      initialized = true;
+    }
+    fftw_plan_with_nthreads(threads);
+#else
+    (void)threads;
+#endif
+  }
+
   static boost::mutex mutex_;
 };
 template<int N> boost::mutex fftw_type_traits<fftw_complex, N>::mutex_;
@@ -194,13 +534,225 @@ private:
 template<int N> boost::mutex fftw_type_traits<fftwl_complex, N>::mutex_;
 */
 
+/* identifies a cached plan.  precision isn't part of the key because
+  each precision has its own cache -- don't use this */
+struct plan_key_ {
+  enum kind_type { complex_dft, real_to_complex, complex_to_real };
+
+  std::vector<int> sizes;
+  kind_type kind;
+  int sign;
+  bool in_place;
+  bool aligned;
+  unsigned flags;
+  int threads;
+  // batch layout; a single transform by default
+  int howmany;
+  int istride;
+  int idist;
+  int ostride;
+  int odist;
+
+  plan_key_()
+    : howmany(1), istride(1), idist(0), ostride(1), odist(0) { }
+
+  inline bool batched() const {
+    return howmany != 1 || istride != 1 || ostride != 1;
+  }
+
+  inline bool operator<(const plan_key_ &k) const {
+    if(sizes != k.sizes) return sizes < k.sizes;
+    if(kind != k.kind) return kind < k.kind;
+    if(howmany != k.howmany) return howmany < k.howmany;
+    if(istride != k.istride) return istride < k.istride;
+    if(idist != k.idist) return idist < k.idist;
+    if(ostride != k.ostride) return ostride < k.ostride;
+    if(odist != k.odist) return odist < k.odist;
+    if(sign != k.sign) return sign < k.sign;
+    if(in_place != k.in_place) return in_place < k.in_place;
+    if(aligned != k.aligned) return aligned < k.aligned;
+    if(flags != k.flags) return flags < k.flags;
+    return threads < k.threads;
+  }
+};
+
+/* process-wide cache of plans, one per precision -- don't use this
+  
+  Plans are made on scratch arrays rather than the caller's, so planning
+  (which overwrites its arrays unless it only estimates) never destroys
+  data, and are then run on the caller's arrays with the new-array
+  execute functions.  Those only require the new arrays to be aligned
+  like the planning arrays, so unaligned callers get plans made with
+  FFTW_UNALIGNED.  Cached plans live until the process exits. */
+template<typename T, int N=0>
+class plan_cache_ {
+public:
+  typedef fftw_type_traits<T> traits;
+  typedef typename traits::plan_type plan_type;
+  typedef typename traits::real_type real_type;
+
+  static plan_type get(const plan_key_ &key) {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      typename std::map<plan_key_, plan_type>::const_iterator it =
+        plans_.find(key);
+      if(it != plans_.end()) return it->second;
+    }
+    // planning can take seconds, so it runs without the cache locked
+    // (FFTW's planner is serialized by the traits); a thread that
+    // planned the same transform meanwhile wins
+    const plan_type plan = create_(key);
+    boost::mutex::scoped_lock lock(mutex_);
+    std::pair<typename std::map<plan_key_, plan_type>::iterator, bool>
+      inserted = plans_.insert(std::make_pair(key, plan));
+    if(!inserted.second) traits::destroy_plan(plan);
+    return inserted.first->second;
+  }
+
+private:
+  static plan_type create_(const plan_key_ &key) {
+
+    // the complex side of a real transform keeps only the non-redundant
+    // half of the last dimension; in place, the real side is padded to
+    // fill the same space
+    const int dim = key.sizes.size();
+    const bool real = key.kind != plan_key_::complex_dft;
+    std::vector<int> real_sizes(key.sizes), complex_sizes(key.sizes);
+    if(real) {
+      complex_sizes[dim - 1] = key.sizes[dim - 1]/2 + 1;
+      if(key.in_place) real_sizes[dim - 1] = 2*complex_sizes[dim - 1];
+    }
+    const bool real_in = key.kind == plan_key_::real_to_complex;
+    const bool real_out = key.kind == plan_key_::complex_to_real;
+    const std::size_t in_bytes = extent_(real_in ? real_sizes : complex_sizes,
+      key.howmany, key.istride, key.idist)
+        * (real_in ? sizeof(real_type) : sizeof(T));
+    const std::size_t out_bytes = extent_(
+      real_out ? real_sizes : complex_sizes, key.howmany, key.ostride,
+      key.odist) * (real_out ? sizeof(real_type) : sizeof(T));
+    T *in = reinterpret_cast<T*>(fftw_malloc(key.in_place
+      ? std::max(in_bytes, out_bytes) : in_bytes));
+    T *out = key.in_place
+      ? in : reinterpret_cast<T*>(fftw_malloc(out_bytes));
+    real_type *in_real = reinterpret_cast<real_type*>(in);
+    real_type *out_real = reinterpret_cast<real_type*>(out);
+    const unsigned flags = key.flags | (key.aligned ? 0 : FFTW_UNALIGNED);
+    const int *sizes = &key.sizes[0];
+    plan_type plan = NULL;
+    if(in == NULL || out == NULL) {
+      // fall through to the error below
+    } else if(key.batched()) {
+      const int *real_embed = (real && key.in_place) ? &real_sizes[0] : NULL;
+      switch(key.kind) {
+      case plan_key_::real_to_complex:
+        plan = traits::create_plan_many(dim, sizes, key.howmany, in_real,
+          real_embed, key.istride, key.idist, out, NULL, key.ostride,
+          key.odist, flags, key.threads);
+        break;
+      case plan_key_::complex_to_real:
+        plan = traits::create_plan_many(dim, sizes, key.howmany, in, NULL,
+          key.istride, key.idist, out_real, real_embed, key.ostride,
+          key.odist, flags, key.threads);
+        break;
+      default:
+        plan = traits::create_plan_many(dim, sizes, key.howmany, in, NULL,
+          key.istride, key.idist, out, NULL, key.ostride, key.odist,
+          key.sign, flags, key.threads);
+      }
+    } else {
+      switch(key.kind) {
+      case plan_key_::real_to_complex:
+        plan = traits::create_plan(dim, sizes, in_real, out, flags,
+          key.threads);
+        break;
+      case plan_key_::complex_to_real:
+        plan = traits::create_plan(dim, sizes, in, out_real, flags,
+          key.threads);
+        break;
+      default:
+        plan = traits::create_plan(dim, sizes, in, out, key.sign, flags,
+          key.threads);
+      }
+    }
+    if(out != in) fftw_free(out);
+    fftw_free(in);
+    if(plan == NULL) {
+      throw std::runtime_error((key.flags & FFTW_WISDOM_ONLY)
+        ? "no FFTW wisdom for this transform"
+        : "couldn't create plan in FFTW");
+    }
+    return plan;
+  }
+
+  // elements spanned by a batch of transforms of the given sizes
+  static std::size_t extent_(const std::vector<int> &sizes, int howmany,
+      int stride, int dist) {
+    std::size_t n = 1;
+    for(std::size_t i=0; i<sizes.size(); ++i) n *= sizes[i];
+    return (howmany - 1)*static_cast<std::size_t>(dist) + (n - 1)*stride + 1;
+  }
+
+  static boost::mutex mutex_;
+  static std::map<plan_key_, plan_type> plans_;
+};
+template<typename T, int N> boost::mutex plan_cache_<T, N>::mutex_;
+template<typename T, int N>
+std::map<plan_key_, typename plan_cache_<T, N>::plan_type>
+  plan_cache_<T, N>::plans_;
+
+/** \brief load FFTW wisdom saved by export_wisdom
+  Plans made afterwards, at any effort, reuse what the wisdom records
+  instead of measuring again.
+  \tparam T - an FFTW complex type; each precision has its own wisdom
+  \param path - wisdom file
+  \returns false if the file is missing or not wisdom for this precision
+ */
+template<typename T>
+inline bool import_wisdom(const std::string &path) {
+  return fftw_type_traits<T>::import_wisdom(path.c_str());
+}
+/** \brief save everything FFTW has learned while planning
+  \tparam T - an FFTW complex type; each precision has its own wisdom
+  \param path - wisdom file
+  \throws std::runtime_error if the file can't be written
+ */
+template<typename T>
+inline void export_wisdom(const std::string &path) {
+  if(!fftw_type_traits<T>::export_wisdom(path.c_str())) {
+    throw std::runtime_error("couldn't write FFTW wisdom " + path);
+  }
+}
+
+/** \brief imports wisdom on construction and exports it on destruction
+  Meant to live for the duration of main() or a service, so planning cost
+  is paid once per machine rather than once per process.  A missing file
+  is fine; it is created on exit.
+  \tparam T - an FFTW complex type; each precision has its own wisdom
+ */
+template<typename T>
+class wisdom_scope : public boost::noncopyable {
+public:
+  /** \param path - wisdom file */
+  explicit wisdom_scope(const std::string &path) : path_(path) {
+    import_wisdom<T>(path_);
+  }
+  ~wisdom_scope() {
+    // nothing useful can be done about a failure during shutdown
+    fftw_type_traits<T>::export_wisdom(path_.c_str());
+  }
+
+private:
+  std::string path_;
+};
+
 /** \brief threadsafe functor for performing a DFT with FFTW
   FFTW is a library for performing Fast Fourier Transforms.  This plan functor
   wraps FFTW's "basic DFT" API in a threadsafe manner.  That is, multiple
   threads can have their own plan objects; multiple threads probably shouldn't
-  operate on a single plan object at once.
-  \tparam T - a std::complex<TYPE>, where TYPE can be float, double or long 
-  double
+  operate on a single plan object at once.  The underlying FFTW plan comes
+  from a process-wide cache, so constructing a plan of a size seen before
+  costs only a lookup, and planning never touches the input or output.
+  \tparam T - an FFTW complex type: fftwf_complex or fftw_complex
  */
 template<typename T>
 class plan {
@@ -221,73 +773,35 @@ public:
     \param in - input
     \param output - output
     \param sizes - sizes of each dimension
+    \param effort - how hard to search for a fast algorithm
+    \param threads - threads FFTW may use; 0 uses the default
    */
   template<typename IN, typename OUT, typename S>
   inline plan(std::size_t dim, bool forward, const IN &in, OUT &out,
-      S sizes)
-        : plan_(NULL) {
-    int dims[dim];
-    for(int i=0; i<dim; ++i) dims[i] = sizes[i];
-    fftw_type* in_ptr = reinterpret_cast<fftw_type*>(
-      &const_cast<IN&>(in)[0]);
-    fftw_type* out_ptr = reinterpret_cast<fftw_type*>(&out[0]);
-    if(in_ptr == out_ptr) {
-      // in-place transform: first check if we can do an in-place
-      // transform just using wisdom.  this would be non-destructive
-      // of the input data
-      plan_ = fftw_type_traits<fftw_type>::create_plan(
-        dim,
-        dims,
-        in_ptr,
-        out_ptr,
-        forward ? FFTW_FORWARD : FFTW_BACKWARD,
-        FFTW_WISDOM_ONLY);
-      if(plan_ == NULL) {
-        // plan could not be created purely from wisdom. we need to
-        // save the input data, create the plan, then restore the
-        // input data
-        //
-        // because this is an in-place transform, the input is not
-        // actually "const," so we're not breaking program semantics
-        // by casting away its constness and writing to it.
-        std::size_t num_samples = 1;
-        for(std::size_t i=0; i<dim; ++i) num_samples *= dims[i];
-        fftw_type buffer[num_samples];
-        memcpy(buffer, in_ptr, sizeof(fftw_type)*num_samples);
-        plan_ = fftw_type_traits<fftw_type>::create_plan(
-          dim,
-          dims,
-          in_ptr,
-          out_ptr,
-          forward ? FFTW_FORWARD : FFTW_BACKWARD,
-          0);
-        memcpy(in_ptr, buffer, sizeof(fftw_type)*num_samples);
-      }
-    } else {
-      // out-of-place transform; simple create the plan as normal
-      plan_ = fftw_type_traits<fftw_type>::create_plan(
-        dim,
-        dims,
-        in_ptr,
-        out_ptr,
-        forward ? FFTW_FORWARD : FFTW_BACKWARD,
-        0);
-    }
-    if(plan_ == NULL) {
-      // if the plan is still NULL, there was a real algorithmic
-      // failure
-      throw std::runtime_error("couldn't create plan in FFTW");
-    }
-  }
-  inline ~plan() {
-    fftw_type_traits<fftw_type>::destroy_plan(plan_);
+      S sizes, planner_effort effort = default_planner_effort(),
+      unsigned threads = 0)
+        : in_(reinterpret_cast<fftw_type*>(&const_cast<IN&>(in)[0])),
+        out_(reinterpret_cast<fftw_type*>(&out[0])) {
+    plan_key_ key;
+    key.sizes.resize(dim);
+    for(std::size_t i=0; i<dim; ++i) key.sizes[i] = sizes[i];
+    key.kind = plan_key_::complex_dft;
+    key.sign = forward ? FFTW_FORWARD : FFTW_BACKWARD;
+    key.in_place = (in_ == out_);
+    key.aligned = fftw_type_traits<fftw_type>::alignment_of(in_) == 0
+      && fftw_type_traits<fftw_type>::alignment_of(out_) == 0;
+    key.flags = planner_flags_(effort);
+    std::size_t num_samples = 1;
+    for(std::size_t i=0; i<dim; ++i) num_samples *= key.sizes[i];
+    key.threads = plan_threads_(threads, num_samples);
+    plan_ = plan_cache_<fftw_type>::get(key);
   }
 
   /** \brief perform the DFT operation.  can be called multiple
     times; each time operates on the same input and output vectors,
     but you _can_ change their contents in-between runs */
   inline void operator()() {
-    fftw_type_traits<fftw_type>::execute_plan(plan_);
+    fftw_type_traits<fftw_type>::execute_plan(plan_, in_, out_);
   }
   /** \brief perform the DFT operation.  can be called multiple
     times; each time operates on the same input and output vectors,
@@ -309,14 +823,322 @@ public:
    \param out - output
   */
   template<typename IN, typename OUT>
-  inline void unsafe_execute(const T &in, T &out) {
+  inline void unsafe_execute(const IN &in, OUT &out) {
     fftw_type* in_ptr = reinterpret_cast<fftw_type*>(
       &const_cast<IN&>(in)[0]);
     fftw_type* out_ptr = reinterpret_cast<fftw_type*>(&out[0]);
-    fftw_execute_dft(plan_, in_ptr, out_ptr);
+    fftw_type_traits<fftw_type>::execute_plan(plan_, in_ptr, out_ptr);
+  }
+
+private:
+  fftw_type *in_;
+  fftw_type *out_;
+  plan_type plan_;
+};
+
+/** \brief functor for a real-input DFT or its inverse with FFTW
+  The forward transform takes n real samples to the n/2+1 complex values
+  that determine the Hermitian spectrum (in the last dimension, for
+  multidimensional transforms); the backward transform takes that half
+  spectrum back to n real samples, unscaled.  Plans are cached as for
+  plan.  In-place transforms need the real array padded to 2*(n/2+1)
+  values in the last dimension, as FFTW requires.  Multidimensional
+  backward transforms may overwrite their input.
+  \tparam T - an FFTW complex type: fftwf_complex or fftw_complex
+ */
+template<typename T>
+class real_plan {
+public:
+  typedef T fftw_type;
+  typedef typename fftw_type_traits<fftw_type>::plan_type plan_type;
+  typedef typename fftw_type_traits<fftw_type>::real_type real_type;
+
+  /**
+    \brief plan a multidimensional real DFT
+    \tparam IN - input type.  Must be conceptually like an array, with
+      linear memory arrangement: real values forward, complex values
+      backward.
+    \tparam OUT - output type.  Complex values forward, real values
+      backward.
+    \tparam S - size array type.  Must be [.]-accessible.
+    \param dim - dimension of DFT, i.e. 1 is 1-dimensional
+    \param forward - true for real to complex, false for complex to real
+    \param in - input
+    \param out - output
+    \param sizes - logical (real) sizes of each dimension
+    \param effort - how hard to search for a fast algorithm
+    \param threads - threads FFTW may use; 0 uses the default
+   */
+  template<typename IN, typename OUT, typename S>
+  inline real_plan(std::size_t dim, bool forward, const IN &in, OUT &out,
+      S sizes, planner_effort effort = default_planner_effort(),
+      unsigned threads = 0)
+        : forward_(forward) {
+    void *in_ptr = &const_cast<IN&>(in)[0];
+    void *out_ptr = &out[0];
+    real_ = reinterpret_cast<real_type*>(forward ? in_ptr : out_ptr);
+    complex_ = reinterpret_cast<fftw_type*>(forward ? out_ptr : in_ptr);
+    plan_key_ key;
+    key.sizes.resize(dim);
+    for(std::size_t i=0; i<dim; ++i) key.sizes[i] = sizes[i];
+    key.kind = forward
+      ? plan_key_::real_to_complex : plan_key_::complex_to_real;
+    key.sign = forward ? FFTW_FORWARD : FFTW_BACKWARD;
+    key.in_place = (in_ptr == out_ptr);
+    key.aligned = fftw_type_traits<fftw_type>::alignment_of(real_) == 0
+      && fftw_type_traits<fftw_type>::alignment_of(complex_) == 0;
+    // one-dimensional complex to real transforms can keep their input
+    key.flags = planner_flags_(effort)
+      | (!forward && dim == 1 ? FFTW_PRESERVE_INPUT : 0);
+    std::size_t num_samples = 1;
+    for(std::size_t i=0; i<dim; ++i) num_samples *= key.sizes[i];
+    key.threads = plan_threads_(threads, num_samples);
+    plan_ = plan_cache_<fftw_type>::get(key);
+  }
+
+  /** \brief perform the DFT operation.  can be called multiple
+    times; each time operates on the same input and output vectors,
+    but you _can_ change their contents in-between runs */
+  inline void operator()() {
+    if(forward_) {
+      fftw_type_traits<fftw_type>::execute_plan(plan_, real_, complex_);
+    } else {
+      fftw_type_traits<fftw_type>::execute_plan(plan_, complex_, real_);
+    }
+  }
+  /** \brief perform the DFT operation */
+  inline void execute() {
+    (*this)();
+  }
+
+  /** \brief perform the DFT operation on a new set of arrays, which
+    must be aligned like the original ones
+    \param in - input
+    \param out - output
+   */
+  template<typename IN, typename OUT>
+  inline void unsafe_execute(const IN &in, OUT &out) {
+    void *in_ptr = &const_cast<IN&>(in)[0];
+    void *out_ptr = &out[0];
+    if(forward_) {
+      fftw_type_traits<fftw_type>::execute_plan(plan_,
+        reinterpret_cast<real_type*>(in_ptr),
+        reinterpret_cast<fftw_type*>(out_ptr));
+    } else {
+      fftw_type_traits<fftw_type>::execute_plan(plan_,
+        reinterpret_cast<fftw_type*>(in_ptr),
+        reinterpret_cast<real_type*>(out_ptr));
+    }
+  }
+
+private:
+  bool forward_;
+  real_type *real_;
+  fftw_type *complex_;
+  plan_type plan_;
+};
+
+/* default distance between batched transforms: packed one after another
+  -- don't use this */
+inline int batch_dist_(const plan_key_ &key, bool real_side) {
+  const int dim = key.sizes.size();
+  int n = 1;
+  for(int i=0; i<dim - 1; ++i) n *= key.sizes[i];
+  const int last = key.sizes[dim - 1];
+  if(key.kind == plan_key_::complex_dft) return n*last;
+  if(!real_side) return n*(last/2 + 1);
+  return n*(key.in_place ? 2*(last/2 + 1) : last);
+}
+
+/** \brief functor for many same-size DFTs in one FFTW execution
+  Wraps FFTW's advanced interface: howmany transforms whose elements are
+  stride apart, with the starts of consecutive transforms dist apart.
+  A matrix of channels stored one channel per row is stride 1, dist the
+  channel length; stored one sample per row it is stride the number of
+  channels, dist 1.  Plans are cached as for plan.
+  \tparam T - an FFTW complex type: fftwf_complex or fftw_complex
+ */
+template<typename T>
+class batch_plan {
+public:
+  typedef T fftw_type;
+  typedef typename fftw_type_traits<fftw_type>::plan_type plan_type;
+
+  /**
+    \brief plan a batch of multidimensional DFTs
+    \tparam IN - input type, with linear memory arrangement
+    \tparam OUT - output type.  Same requirements as input.
+    \tparam S - size array type.  Must be [.]-accessible.
+    \param dim - dimension of each DFT
+    \param forward - true for DFT, false for IDFT
+    \param in - input
+    \param out - output
+    \param sizes - sizes of each dimension of one DFT
+    \param howmany - number of DFTs
+    \param istride - distance between input elements of one DFT
+    \param idist - distance between the first input elements of
+      consecutive DFTs; 0 packs them one after another
+    \param ostride - distance between output elements of one DFT
+    \param odist - as idist, for the output
+    \param effort - how hard to search for a fast algorithm
+    \param threads - threads FFTW may use; 0 uses the default
+   */
+  template<typename IN, typename OUT, typename S>
+  inline batch_plan(std::size_t dim, bool forward, const IN &in, OUT &out,
+      S sizes, int howmany, int istride = 1, int idist = 0,
+      int ostride = 1, int odist = 0,
+      planner_effort effort = default_planner_effort(),
+      unsigned threads = 0)
+        : in_(reinterpret_cast<fftw_type*>(&const_cast<IN&>(in)[0])),
+        out_(reinterpret_cast<fftw_type*>(&out[0])) {
+    plan_key_ key;
+    key.sizes.resize(dim);
+    for(std::size_t i=0; i<dim; ++i) key.sizes[i] = sizes[i];
+    key.kind = plan_key_::complex_dft;
+    key.sign = forward ? FFTW_FORWARD : FFTW_BACKWARD;
+    key.in_place = (in_ == out_);
+    key.aligned = fftw_type_traits<fftw_type>::alignment_of(in_) == 0
+      && fftw_type_traits<fftw_type>::alignment_of(out_) == 0;
+    key.flags = planner_flags_(effort);
+    key.howmany = howmany;
+    key.istride = istride;
+    key.ostride = ostride;
+    key.idist = idist != 0 ? idist : batch_dist_(key, false);
+    key.odist = odist != 0 ? odist : batch_dist_(key, false);
+    key.threads = plan_threads_(threads,
+      static_cast<std::size_t>(batch_dist_(key, false))*howmany);
+    plan_ = plan_cache_<fftw_type>::get(key);
+  }
+
+  /** \brief perform all the DFTs */
+  inline void operator()() {
+    fftw_type_traits<fftw_type>::execute_plan(plan_, in_, out_);
+  }
+  /** \brief perform all the DFTs */
+  inline void execute() {
+    (*this)();
+  }
+
+  /** \brief perform the DFTs on a new set of arrays, laid out and
+    aligned like the original ones
+    \param in - input
+    \param out - output
+   */
+  template<typename IN, typename OUT>
+  inline void unsafe_execute(const IN &in, OUT &out) {
+    fftw_type_traits<fftw_type>::execute_plan(plan_,
+      reinterpret_cast<fftw_type*>(&const_cast<IN&>(in)[0]),
+      reinterpret_cast<fftw_type*>(&out[0]));
   }
 
 private:
+  fftw_type *in_;
+  fftw_type *out_;
+  plan_type plan_;
+};
+
+/** \brief functor for many same-size real DFTs, or their inverses, in
+  one FFTW execution
+  Combines the layout of batch_plan with the half spectra of real_plan.
+  Default distances pack the real side (padded, in place) and the
+  complex side one transform after another.
+  \tparam T - an FFTW complex type: fftwf_complex or fftw_complex
+ */
+template<typename T>
+class real_batch_plan {
+public:
+  typedef T fftw_type;
+  typedef typename fftw_type_traits<fftw_type>::plan_type plan_type;
+  typedef typename fftw_type_traits<fftw_type>::real_type real_type;
+
+  /**
+    \brief plan a batch of multidimensional real DFTs
+    \tparam IN - input type: real values forward, complex backward
+    \tparam OUT - output type: complex values forward, real backward
+    \tparam S - size array type.  Must be [.]-accessible.
+    \param dim - dimension of each DFT
+    \param forward - true for real to complex, false for complex to real
+    \param in - input
+    \param out - output
+    \param sizes - logical (real) sizes of each dimension of one DFT
+    \param howmany - number of DFTs
+    \param istride - distance between input elements of one DFT
+    \param idist - distance between the first input elements of
+      consecutive DFTs; 0 packs them one after another
+    \param ostride - distance between output elements of one DFT
+    \param odist - as idist, for the output
+    \param effort - how hard to search for a fast algorithm
+    \param threads - threads FFTW may use; 0 uses the default
+   */
+  template<typename IN, typename OUT, typename S>
+  inline real_batch_plan(std::size_t dim, bool forward, const IN &in,
+      OUT &out, S sizes, int howmany, int istride = 1, int idist = 0,
+      int ostride = 1, int odist = 0,
+      planner_effort effort = default_planner_effort(),
+      unsigned threads = 0)
+        : forward_(forward) {
+    void *in_ptr = &const_cast<IN&>(in)[0];
+    void *out_ptr = &out[0];
+    real_ = reinterpret_cast<real_type*>(forward ? in_ptr : out_ptr);
+    complex_ = reinterpret_cast<fftw_type*>(forward ? out_ptr : in_ptr);
+    plan_key_ key;
+    key.sizes.resize(dim);
+    for(std::size_t i=0; i<dim; ++i) key.sizes[i] = sizes[i];
+    key.kind = forward
+      ? plan_key_::real_to_complex : plan_key_::complex_to_real;
+    key.sign = forward ? FFTW_FORWARD : FFTW_BACKWARD;
+    key.in_place = (in_ptr == out_ptr);
+    key.aligned = fftw_type_traits<fftw_type>::alignment_of(real_) == 0
+      && fftw_type_traits<fftw_type>::alignment_of(complex_) == 0;
+    key.flags = planner_flags_(effort)
+      | (!forward && dim == 1 ? FFTW_PRESERVE_INPUT : 0);
+    key.howmany = howmany;
+    key.istride = istride;
+    key.ostride = ostride;
+    key.idist = idist != 0 ? idist : batch_dist_(key, forward);
+    key.odist = odist != 0 ? odist : batch_dist_(key, !forward);
+    key.threads = plan_threads_(threads,
+      static_cast<std::size_t>(batch_dist_(key, true))*howmany);
+    plan_ = plan_cache_<fftw_type>::get(key);
+  }
+
+  /** \brief perform all the DFTs */
+  inline void operator()() {
+    if(forward_) {
+      fftw_type_traits<fftw_type>::execute_plan(plan_, real_, complex_);
+    } else {
+      fftw_type_traits<fftw_type>::execute_plan(plan_, complex_, real_);
+    }
+  }
+  /** \brief perform all the DFTs */
+  inline void execute() {
+    (*this)();
+  }
+
+  /** \brief perform the DFTs on a new set of arrays, laid out and
+    aligned like the original ones
+    \param in - input
+    \param out - output
+   */
+  template<typename IN, typename OUT>
+  inline void unsafe_execute(const IN &in, OUT &out) {
+    void *in_ptr = &const_cast<IN&>(in)[0];
+    void *out_ptr = &out[0];
+    if(forward_) {
+      fftw_type_traits<fftw_type>::execute_plan(plan_,
+        reinterpret_cast<real_type*>(in_ptr),
+        reinterpret_cast<fftw_type*>(out_ptr));
+    } else {
+      fftw_type_traits<fftw_type>::execute_plan(plan_,
+        reinterpret_cast<fftw_type*>(in_ptr),
+        reinterpret_cast<real_type*>(out_ptr));
+    }
+  }
+
+private:
+  bool forward_;
+  real_type *real_;
+  fftw_type *complex_;
   plan_type plan_;
 };
 
@@ -334,8 +1156,8 @@ inline void general_fft_(const IN &in, OUT &out, std::size_t in_size,
   /* In the case where input and output sizes differ:
     1) in == out: Perform an [i]fft as normal
     2) in < out: Copy in to out w/ zero-padding and fft out in-place
-    3) in > out: Perform an [i]fft from in to out, truncating elements of
-      in. */
+    3) in > out: Perform an out_size-point [i]fft from in to out, 
+      truncating elements of in. */
   if(in_size < out_size) {
     // TODO maybe replace with a memset and memcpy?
     for(std::size_t i=0; i<in_size; ++i) {
@@ -346,7 +1168,8 @@ inline void general_fft_(const IN &in, OUT &out, std::size_t in_size,
     }
     general_fft_<OUT, OUT, FORWARD>(out, out, out_size, out_size);
   } else {
-    std::size_t sizes[] = { in_size, out_size };
+    // a truncating transform only reads the first out_size inputs
+    std::size_t sizes[] = { out_size };
     plan<fftw_type> plan_fct(
       1,
       FORWARD,
@@ -358,7 +1181,7 @@ inline void general_fft_(const IN &in, OUT &out, std::size_t in_size,
     // FFTW doesn't scale values on ifft.  We do that here.
     if(!FORWARD) {
       real_type den = real_type(1.0) / out_size;
-      for(int i=0; i<out_size; ++i) out[i] *= den;
+      for(std::size_t i=0; i<out_size; ++i) out[i] *= den;
     }
   }
 }
@@ -416,9 +1239,91 @@ inline void ifft(const IN &in, OUT &out, std::size_t in_size,
   general_fft_<IN, OUT, false>(in, out, in_size, out_size);
 }
 
+/** \brief smallest transform length of at least n samples with no prime
+  factor above 7
+  FFTW is fastest on such lengths, and a convolution can be padded to any
+  length past its own without changing the result, so a prime length
+  needn't be used just because the series happen to add up to one.
+ */
+inline std::size_t fast_size(std::size_t n) {
+  std::size_t best = 1;
+  while(best < n) best *= 2;
+  for(std::size_t p7=1; p7<best; p7*=7) {
+    for(std::size_t p5=p7; p5<best; p5*=5) {
+      for(std::size_t p3=p5; p3<best; p3*=3) {
+        std::size_t size = p3;
+        while(size < n) size *= 2;
+        best = std::min(best, size);
+      }
+    }
+  }
+  return best;
+}
+
+/* per-thread scratch for conv() and rconv(), grown as needed and kept
+  between calls -- don't use this */
+template<typename R, int N=0> struct conv_workspace_ {
+  std::vector<std::complex<R>, simd_alloc<std::complex<R> > > spectrum1;
+  std::vector<std::complex<R>, simd_alloc<std::complex<R> > > spectrum2;
+  std::vector<R, simd_alloc<R> > samples;
+
+  static conv_workspace_& get(std::size_t complex_size,
+      std::size_t real_size) {
+    conv_workspace_ *w = current_.get();
+    if(w == NULL) {
+      w = new conv_workspace_;
+      current_.reset(w);
+    }
+    if(w->spectrum1.size() < complex_size) {
+      w->spectrum1.resize(complex_size);
+      w->spectrum2.resize(complex_size);
+    }
+    if(w->samples.size() < real_size) w->samples.resize(real_size);
+    return *w;
+  }
+
+  static boost::thread_specific_ptr<conv_workspace_> current_;
+};
+template<typename R, int N>
+boost::thread_specific_ptr<conv_workspace_<R, N> >
+  conv_workspace_<R, N>::current_;
+
+/* true when summing products directly is cheaper than three transforms
+  of length n: a multiply-add costs about as much as a quarter of a
+  butterfly -- don't use this */
+inline bool conv_is_direct_(std::size_t in1_size, std::size_t in2_size,
+    std::size_t n) {
+  std::size_t log2n = 0;
+  for(std::size_t m=n; m>1; m>>=1) ++log2n;
+  return static_cast<double>(in1_size) * in2_size
+    <= 2.0 * n * (log2n + 1);
+}
+
+/* out = a * b by direct summation, the shorter series outside so the
+  inner loop is long -- don't use this */
+template<typename T>
+inline void conv_direct_(const T *a, std::size_t a_size, const T *b,
+    std::size_t b_size, T *out) {
+  if(a_size > b_size) {
+    std::swap(a, b);
+    std::swap(a_size, b_size);
+  }
+  std::fill(out, out + a_size + b_size - 1, T(0));
+  for(std::size_t i=0; i<a_size; ++i) {
+    const T x = a[i];
+    T *o = out + i;
+    for(std::size_t j=0; j<b_size; ++j) o[j] += x * b[j];
+  }
+}
+
 /** \brief compute a 1D convolution quickly using FFTs
+  The transforms are padded to fast_size(in1_size+in2_size-1) and run in
+  a per-thread workspace that is reused between calls, so repeated
+  convolutions don't allocate.  When one series is short enough that
+  direct summation is cheaper, no transform is done at all.
   \tparam IN1 - input 1.  Must be indexable with linear memory.
-  \tparam IN2 - input 2.  Must be indexable with linear memory.
+  \tparam IN2 - input 2, same precision as input 1.  Must be indexable
+    with linear memory.
   \tparam OUT - output.  Must be indexable with linear memory
   \param in1 - input series 1
   \param in2 - input series 2
@@ -431,23 +1336,35 @@ template<typename IN1, typename IN2, typename OUT>
 inline void conv(const IN1 &in1, const IN2 &in2, OUT &out, 
     std::size_t in1_size, std::size_t in2_size) {
   typedef typename ghp::container_traits<IN1>::value_type in1_value_type;
-  typedef typename ghp::container_traits<IN2>::value_type in2_value_type;
-  typedef typename cpp2fftw<in1_value_type>::value_type fftw_type_1;
-  typedef typename cpp2fftw<in2_value_type>::value_type fftw_type_2;
-  typedef typename fftw2cpp<fftw_type_1>::value_type cpp_type_1;
-  typedef typename fftw2cpp<fftw_type_2>::value_type cpp_type_2;
+  typedef typename cpp2fftw<in1_value_type>::value_type fftw_type;
+  typedef typename fftw2cpp<fftw_type>::value_type cpp_type;
+  typedef typename cpp_type::value_type real_type;
 
   const std::size_t filt_size = in1_size + in2_size - 1;
-  std::vector<cpp_type_1, simd_alloc<cpp_type_1> > filt1(filt_size);
-  std::vector<cpp_type_2, simd_alloc<cpp_type_2> > filt2(filt_size);
+  const std::size_t n = fast_size(filt_size);
+  // results go through the workspace, so out may alias an input
+  if(conv_is_direct_(in1_size, in2_size, n)) {
+    conv_workspace_<real_type> &w =
+      conv_workspace_<real_type>::get(filt_size, 0);
+    conv_direct_(reinterpret_cast<const cpp_type*>(&in1[0]), in1_size,
+      reinterpret_cast<const cpp_type*>(&in2[0]), in2_size,
+      &w.spectrum1[0]);
+    std::copy(w.spectrum1.begin(), w.spectrum1.begin() + filt_size, &out[0]);
+    return;
+  }
 
-  memcpy(&filt1[0], &in1[0], sizeof(cpp_type_1)*in1_size);
-  fft(filt1, filt1, filt_size, filt_size);
-  fft(in2, filt2, in2_size, filt_size);
-  for(std::size_t i=0; i<filt_size; ++i) {
-    out[i] = filt1[i] * filt2[i];
+  conv_workspace_<real_type> &w = conv_workspace_<real_type>::get(n, 0);
+  fft(in1, w.spectrum1, in1_size, n);
+  fft(in2, w.spectrum2, in2_size, n);
+  // the inverse transform's 1/n is folded into the product
+  const real_type scale = real_type(1) / n;
+  for(std::size_t i=0; i<n; ++i) {
+    w.spectrum1[i] *= w.spectrum2[i] * scale;
   }
-  ifft(out, out, filt_size, filt_size);
+  const std::size_t sizes[] = { n };
+  plan<fftw_type> backward(1, false, w.spectrum1, w.spectrum1, sizes);
+  backward();
+  std::copy(w.spectrum1.begin(), w.spectrum1.begin() + filt_size, &out[0]);
 }
 /** \brief compute a 1D convolution quickly using FFTs
   \tparam IN1 - input 1.  Must be indexable with linear memory and have
@@ -465,11 +1382,336 @@ inline void conv(const IN1 &in1, const IN2 &in2, OUT &out) {
   conv(in1, in2, out, in1.size(), in2.size());
 }
 
-template<typename IN, typename OUT, typename S1, typename S2, typename S3>
+/** \brief compute a 1D DFT of real data
+  Only the n/2+1 non-redundant values of the Hermitian spectrum are
+  produced.
+  \tparam IN - input, float or double.  Must be indexable with linear
+    memory.
+  \tparam OUT - output, std::complex of the same precision.  Must be
+    indexable with linear memory.
+  \param in - input data
+  \param out - output data, with room for n/2+1 values
+  \param in_size - size of input vector
+  \param n - length of the transform; the input is zero-padded or
+    truncated to it
+ */
+template<typename IN, typename OUT>
+inline void rfft(const IN &in, OUT &out, std::size_t in_size,
+    std::size_t n) {
+  typedef typename ghp::container_traits<IN>::value_type real_type;
+  typedef typename real2fftw<real_type>::value_type fftw_type;
+  const std::size_t sizes[] = { n };
+  if(in_size < n) {
+    std::vector<real_type, simd_alloc<real_type> > padded(n);
+    std::copy(&in[0], &in[0] + in_size, padded.begin());
+    real_plan<fftw_type> plan_fct(1, true, padded, out, sizes);
+    plan_fct();
+  } else {
+    real_plan<fftw_type> plan_fct(1, true, in, out, sizes);
+    plan_fct();
+  }
+}
+/** \brief compute a 1D DFT of real data
+  \tparam IN - input, float or double.  Must be indexable with linear
+    memory and have .size() method
+  \tparam OUT - output, std::complex of the same precision
+  \param in - input data
+  \param out - output data, with room for in.size()/2+1 values
+ */
+template<typename IN, typename OUT>
+inline void rfft(const IN &in, OUT &out) {
+  rfft(in, out, in.size(), in.size());
+}
+/** \brief compute a 1D inverse DFT with real output
+  \tparam IN - input, std::complex.  Must be indexable with linear
+    memory.
+  \tparam OUT - output, float or double of the same precision
+  \param in - the n/2+1 values of a Hermitian spectrum
+  \param out - output data, with room for n values
+  \param n - length of the transform
+ */
+template<typename IN, typename OUT>
+inline void irfft(const IN &in, OUT &out, std::size_t n) {
+  typedef typename ghp::container_traits<OUT>::value_type real_type;
+  typedef typename real2fftw<real_type>::value_type fftw_type;
+  const std::size_t sizes[] = { n };
+  real_plan<fftw_type> plan_fct(1, false, in, out, sizes);
+  plan_fct();
+  // FFTW doesn't scale values on ifft.  We do that here.
+  const real_type den = real_type(1.0) / n;
+  for(std::size_t i=0; i<n; ++i) out[i] *= den;
+}
+/** \brief compute a 1D inverse DFT with real output
+  \tparam IN - input, std::complex
+  \tparam OUT - output, float or double.  Must have .size() method
+  \param in - the out.size()/2+1 values of a Hermitian spectrum
+  \param out - output data
+ */
+template<typename IN, typename OUT>
+inline void irfft(const IN &in, OUT &out) {
+  irfft(in, out, out.size());
+}
+
+/** \brief compute a 1D convolution of real series quickly using real
+  FFTs, at about half the cost of conv
+  Padding, workspace reuse and the direct path for short series are as
+  for conv.
+  \tparam IN1 - input 1, float or double.  Must be indexable with linear
+    memory.
+  \tparam IN2 - input 2, same precision as input 1.
+  \tparam OUT - output, same precision.  Must be indexable with linear
+    memory
+  \param in1 - input series 1
+  \param in2 - input series 2
+  \param out - output vector.  Must be preallocated with enough
+    room for the convolution: in1_size+in2_size-1
+  \param in1_size - size of input series 1
+  \param in2_size - size of input series 2
+ */
+template<typename IN1, typename IN2, typename OUT>
+inline void rconv(const IN1 &in1, const IN2 &in2, OUT &out,
+    std::size_t in1_size, std::size_t in2_size) {
+  typedef typename ghp::container_traits<IN1>::value_type real_type;
+  typedef typename real2fftw<real_type>::value_type fftw_type;
+
+  const std::size_t filt_size = in1_size + in2_size - 1;
+  const std::size_t n = fast_size(filt_size);
+  if(conv_is_direct_(in1_size, in2_size, n)) {
+    conv_workspace_<real_type> &w =
+      conv_workspace_<real_type>::get(0, filt_size);
+    conv_direct_(&in1[0], in1_size, &in2[0], in2_size, &w.samples[0]);
+    std::copy(w.samples.begin(), w.samples.begin() + filt_size, &out[0]);
+    return;
+  }
+
+  const std::size_t bins = n/2 + 1;
+  conv_workspace_<real_type> &w = conv_workspace_<real_type>::get(bins, n);
+  const std::size_t sizes[] = { n };
+  real_plan<fftw_type> forward1(1, true, w.samples, w.spectrum1, sizes);
+  real_plan<fftw_type> forward2(1, true, w.samples, w.spectrum2, sizes);
+  std::copy(&in1[0], &in1[0] + in1_size, w.samples.begin());
+  std::fill(w.samples.begin() + in1_size, w.samples.begin() + n,
+    real_type(0));
+  forward1();
+  std::copy(&in2[0], &in2[0] + in2_size, w.samples.begin());
+  std::fill(w.samples.begin() + in2_size, w.samples.begin() + n,
+    real_type(0));
+  forward2();
+  // the inverse transform's 1/n is folded into the product
+  const real_type scale = real_type(1) / n;
+  for(std::size_t i=0; i<bins; ++i) {
+    w.spectrum1[i] *= w.spectrum2[i] * scale;
+  }
+  real_plan<fftw_type> backward(1, false, w.spectrum1, w.samples, sizes);
+  backward();
+  std::copy(w.samples.begin(), w.samples.begin() + filt_size, &out[0]);
+}
+/** \brief compute a 1D convolution of real series quickly using real
+  FFTs
+  \tparam IN1 - input 1, float or double.  Must be indexable with linear
+    memory and have .size() method
+  \tparam IN2 - input 2.  Same properties as input 1.
+  \tparam OUT - output.  Must be indexable with linear memory
+  \param in1 - input series 1
+  \param in2 - input series 2
+  \param out - output vector.  Must be preallocated with enough
+    room for the convolution: in1_size+in2_size-1
+ */
+template<typename IN1, typename IN2, typename OUT>
+inline void rconv(const IN1 &in1, const IN2 &in2, OUT &out) {
+  rconv(in1, in2, out, in1.size(), in2.size());
+}
+
+/** \brief how a streaming_convolver joins consecutive blocks */
+enum convolution_method {
+  /** transform zero-padded input blocks, add the overlapping tails */
+  overlap_add,
+  /** transform overlapping input windows, discard the wrapped part */
+  overlap_save
+};
+
+/** \brief FIR filter for unbounded real signals, a block at a time
+  The filter spectrum, buffers and plans are all set up on construction,
+  so processing a block costs two real FFTs and a spectrum multiply, with
+  no allocation and constant memory however long the stream runs.  Each
+  output block is the filtered signal for the samples of the matching
+  input block; there's no added delay beyond the block itself.
+
+  Unpartitioned, the whole filter is one spectrum and the transform
+  length grows with the filter.  Partitioned, the filter is cut into
+  block-sized pieces whose spectra meet a delay line of past input
+  spectra (uniformly partitioned convolution), so long filters can run
+  with short blocks at low latency, the transform staying about twice the
+  block size.  Convolvers can't be copied, since their plans point into
+  their own buffers; hold them by pointer to keep several.
+  \tparam R - sample type, float or double
+ */
+template<typename R>
+class streaming_convolver : public boost::noncopyable {
+public:
+  typedef R real_type;
+  typedef std::complex<R> complex_type;
+  typedef typename real2fftw<R>::value_type fftw_type;
+
+  /**
+    \param filter - filter taps
+    \param filter_size - number of taps
+    \param block_size - samples per call to process()
+    \param method - overlap_add or overlap_save
+    \param partitioned - cut the filter into block_size pieces
+    \param effort - how hard to search for fast transforms
+   */
+  streaming_convolver(const R *filter, std::size_t filter_size,
+      std::size_t block_size, convolution_method method = overlap_save,
+      bool partitioned = false,
+      planner_effort effort = default_planner_effort())
+        : method_(method),
+        block_(checked_block_size_(filter_size, block_size)),
+        piece_(partitioned ? block_size : filter_size),
+        pieces_((filter_size + piece_ - 1) / piece_),
+        size_(static_cast<int>(fast_size(block_ + piece_ - 1))),
+        bins_(size_/2 + 1),
+        time_(size_),
+        tail_(size_),
+        spectrum_(bins_),
+        sum_(bins_),
+        filters_(pieces_*bins_),
+        history_(pieces_*bins_),
+        current_(0),
+        forward_(1, true, time_, spectrum_, &size_, effort),
+        backward_(1, false, sum_, time_, &size_, effort) {
+    // filter spectra, with the inverse transform's 1/n folded in
+    const R scale = R(1) / size_;
+    for(std::size_t p=0; p<pieces_; ++p) {
+      const std::size_t begin = p*piece_;
+      const std::size_t n = std::min(piece_, filter_size - begin);
+      std::fill(time_.begin(), time_.end(), R(0));
+      for(std::size_t i=0; i<n; ++i) time_[i] = filter[begin + i] * scale;
+      forward_();
+      std::copy(spectrum_.begin(), spectrum_.end(),
+        filters_.begin() + p*bins_);
+    }
+    reset();
+  }
+
+  /** \brief forget all past input, as if newly constructed */
+  void reset() {
+    std::fill(time_.begin(), time_.end(), R(0));
+    std::fill(tail_.begin(), tail_.end(), R(0));
+    std::fill(history_.begin(), history_.end(), complex_type(0));
+    current_ = 0;
+  }
+
+  /** \brief samples consumed and produced by each call to process() */
+  inline std::size_t block_size() const { return block_; }
+  /** \brief length of the transforms used */
+  inline std::size_t fft_size() const { return size_; }
+
+  /**
+    \brief filter one block
+    \param in - block_size() input samples
+    \param out - receives block_size() output samples; may be in
+   */
+  void process(const R *in, R *out) {
+    // transform the new input: the latest window for overlap-save, the
+    // zero-padded block for overlap-add
+    if(method_ == overlap_save) {
+      std::copy(tail_.begin() + block_, tail_.end(), tail_.begin());
+      std::copy(in, in + block_, tail_.end() - block_);
+      std::copy(tail_.begin(), tail_.end(), time_.begin());
+    } else {
+      std::copy(in, in + block_, time_.begin());
+      std::fill(time_.begin() + block_, time_.end(), R(0));
+    }
+    forward_();
+    current_ = (current_ + pieces_ - 1) % pieces_;
+    std::copy(spectrum_.begin(), spectrum_.end(),
+      history_.begin() + current_*bins_);
+
+    // input spectrum p blocks ago meets filter piece p
+    std::fill(sum_.begin(), sum_.end(), complex_type(0));
+    for(std::size_t p=0; p<pieces_; ++p) {
+      const complex_type *x = &history_[((current_ + p) % pieces_)*bins_];
+      const complex_type *h = &filters_[p*bins_];
+      complex_type *y = &sum_[0];
+      for(std::size_t i=0; i<bins_; ++i) y[i] += x[i] * h[i];
+    }
+    backward_();
+
+    if(method_ == overlap_save) {
+      std::copy(time_.end() - block_, time_.end(), out);
+    } else {
+      for(std::size_t i=0; i<tail_.size(); ++i) tail_[i] += time_[i];
+      std::copy(tail_.begin(), tail_.begin() + block_, out);
+      std::copy(tail_.begin() + block_, tail_.end(), tail_.begin());
+      std::fill(tail_.end() - block_, tail_.end(), R(0));
+    }
+  }
+
+private:
+  // the sizes are checked before any member divides by them
+  static std::size_t checked_block_size_(std::size_t filter_size,
+      std::size_t block_size) {
+    if(filter_size == 0 || block_size == 0) {
+      throw std::runtime_error("streaming_convolver needs a filter and "
+        "a block size");
+    }
+    return block_size;
+  }
+
+  convolution_method method_;
+  std::size_t block_;
+  std::size_t piece_;
+  std::size_t pieces_;
+  int size_;
+  std::size_t bins_;
+  std::vector<R, simd_alloc<R> > time_;
+  // overlap-save: the current input window; overlap-add: pending output
+  std::vector<R, simd_alloc<R> > tail_;
+  std::vector<complex_type, simd_alloc<complex_type> > spectrum_;
+  std::vector<complex_type, simd_alloc<complex_type> > sum_;
+  std::vector<complex_type, simd_alloc<complex_type> > filters_;
+  // past input spectra, newest at current_
+  std::vector<complex_type, simd_alloc<complex_type> > history_;
+  std::size_t current_;
+  real_plan<fftw_type> forward_;
+  real_plan<fftw_type> backward_;
+};
+
+/* copy the block of in at dimension cur_dim into out, truncating and
+  zero-padding each dimension -- don't use this function */
+template<typename IN, typename OUT, typename S1, typename S2>
 inline void general_fftn_helper_(
-    int N, int cur_dim, S1 cur_coord,
-    IN in, S2 in_size,
-    OUT out, S3 out_size) {
+    int N, int cur_dim,
+    const IN &in, std::size_t in_offset, const S1 &in_sizes,
+    OUT &out, std::size_t out_offset, const S2 &out_sizes) {
+  typedef typename ghp::container_traits<OUT>::value_type cpp_type;
+  const std::size_t in_size = in_sizes[cur_dim];
+  const std::size_t out_size = out_sizes[cur_dim];
+  const std::size_t kept = std::min(in_size, out_size);
+  if(cur_dim == N - 1) {
+    for(std::size_t i=0; i<kept; ++i) {
+      out[out_offset + i] = in[in_offset + i];
+    }
+    for(std::size_t i=kept; i<out_size; ++i) {
+      out[out_offset + i] = cpp_type(0);
+    }
+    return;
+  }
+  // elements in one step along this dimension
+  std::size_t in_step = 1, out_step = 1;
+  for(int d=cur_dim + 1; d<N; ++d) {
+    in_step *= in_sizes[d];
+    out_step *= out_sizes[d];
+  }
+  for(std::size_t i=0; i<kept; ++i) {
+    general_fftn_helper_(N, cur_dim + 1,
+      in, in_offset + i*in_step, in_sizes,
+      out, out_offset + i*out_step, out_sizes);
+  }
+  for(std::size_t i=kept*out_step; i<out_size*out_step; ++i) {
+    out[out_offset + i] = cpp_type(0);
+  }
 }
 
 /* general multidimensional fft -- don't use this function.  more
@@ -477,24 +1719,22 @@ inline void general_fftn_helper_(
 template<typename IN, typename OUT, bool FORWARD, typename S1,
     typename S2>
 inline void general_fftn_(int N, const IN &in, OUT &out, 
-    const S1 &in_sizes, const S2 &out_sizes, bool skip_size_check=false) {
+    const S1 &in_sizes, const S2 &out_sizes) {
   typedef typename ghp::container_traits<IN>::value_type cpp_type;
-  typedef typename cpp:type::value_type real_type;
+  typedef typename cpp_type::value_type real_type;
   typedef typename cpp2fftw<cpp_type>::value_type fftw_type;
   /* check dimensions for padding/truncating situations */
   bool size_changed = false;
-  if(!skip_size_check) {
-    for(int i=0; i<N; ++i) {
-      if(in_sizes[i] != out_sizes[i]) {
-        size_changed = true;
-      }
+  std::vector<int> sizes(N);
+  std::size_t out_num_samples = 1;
+  for(int i=0; i<N; ++i) {
+    if(in_sizes[i] != out_sizes[i]) {
+      size_changed = true;
     }
+    sizes[i] = out_sizes[i];
+    out_num_samples *= out_sizes[i];
   }
   if(size_changed) {
-    std::size_t out_addr[N];
-    for(int i=0; i<N; ++i) {
-      out_addr[i] = 0;
-    }
     // we "project" the input data onto the output data (the analogy 
     // works in 2d, gets weird in 3d), and copy it across with 
     // truncation and zero padding as appropriate, then perform 
@@ -502,33 +1742,75 @@ inline void general_fftn_(int N, const IN &in, OUT &out,
     // dealing with N dimensions, this operation is a little hairy
     // and we use the (execution) stack to help us keep track of
     // all the dimensions.
-    general_fftn_helper_
-    general_fftn_<OUT, OUT, FORWARD>(N, out, out, out_sizes, out_sizes,
-        true);
+    general_fftn_helper_(N, 0, in, 0, in_sizes, out, 0, out_sizes);
+    plan<fftw_type> plan_fct(N, FORWARD, out, out, sizes);
+    plan_fct();
   } else {
     /* no expansion/padding was performed; perform [i]fft as normal */
-    plan<fftw_type> plan_fct(
-        N,
-        FORWARD,
-        in,
-        out,
-        in_sizes
-    );
+    plan<fftw_type> plan_fct(N, FORWARD, in, out, sizes);
     plan_fct();
-    /* FFTW doesn't scale values on ifft.  Do that here */
-    if(!FORWARD) {
-      int out_num_samples = 1;
-      for(int i=0; i<N; ++i) {
-        out_num_samples *= out_size[i];
-      }
-      real_type den = 1. / out_num_samples;
-      for(int i=0; i<out_num_samples; ++i) {
-        out[i] *= den;
-      }
+  }
+  /* FFTW doesn't scale values on ifft.  Do that here */
+  if(!FORWARD) {
+    const real_type den = real_type(1.0) / out_num_samples;
+    for(std::size_t i=0; i<out_num_samples; ++i) {
+      out[i] *= den;
     }
   }
 }
 
+/** \brief compute an N-dimensional DFT
+  Data is stored row-major: the last dimension varies fastest.
+  \tparam IN - input.  Must be indexable with linear memory.
+  \tparam OUT - output.  Same properties as input.
+  \tparam S1 - size array type.  Must be [.]-accessible.
+  \tparam S2 - size array type.  Must be [.]-accessible.
+  \param N - number of dimensions
+  \param in - input data
+  \param out - output data.  Must be sized appropriately.  Where a
+    dimension is larger than the input's, the input is zero-padded;
+    where smaller, truncated.  Must not overlap in if any size differs.
+  \param in_sizes - size of each input dimension
+  \param out_sizes - size of each output dimension */
+template<typename IN, typename OUT, typename S1, typename S2>
+inline void fftn(int N, const IN &in, OUT &out, const S1 &in_sizes,
+    const S2 &out_sizes) {
+  general_fftn_<IN, OUT, true>(N, in, out, in_sizes, out_sizes);
+}
+/** \brief compute an N-dimensional inverse DFT
+  \tparam IN - input.  Must be indexable with linear memory.
+  \tparam OUT - output.  Same properties as input.
+  \tparam S1 - size array type.  Must be [.]-accessible.
+  \tparam S2 - size array type.  Must be [.]-accessible.
+  \param N - number of dimensions
+  \param in - input data
+  \param out - output data, zero-padded or truncated as for fftn
+  \param in_sizes - size of each input dimension
+  \param out_sizes - size of each output dimension */
+template<typename IN, typename OUT, typename S1, typename S2>
+inline void ifftn(int N, const IN &in, OUT &out, const S1 &in_sizes,
+    const S2 &out_sizes) {
+  general_fftn_<IN, OUT, false>(N, in, out, in_sizes, out_sizes);
+}
+/** \brief compute an N-dimensional DFT of the same size
+  \param N - number of dimensions
+  \param in - input data
+  \param out - output data
+  \param sizes - size of each dimension */
+template<typename IN, typename OUT, typename S>
+inline void fftn(int N, const IN &in, OUT &out, const S &sizes) {
+  general_fftn_<IN, OUT, true>(N, in, out, sizes, sizes);
+}
+/** \brief compute an N-dimensional inverse DFT of the same size
+  \param N - number of dimensions
+  \param in - input data
+  \param out - output data
+  \param sizes - size of each dimension */
+template<typename IN, typename OUT, typename S>
+inline void ifftn(int N, const IN &in, OUT &out, const S &sizes) {
+  general_fftn_<IN, OUT, false>(N, in, out, sizes, sizes);
+}
+
 }
 
 #endif
@@ -0,0 +1,212 @@
+#ifndef _GHP_MATH_HALF_EDGE_HPP_
+#define _GHP_MATH_HALF_EDGE_HPP_
+
+#include <vector>
+
+namespace ghp {
+
+/**
+  \brief half-edge adjacency of a triangle mesh, in flat arrays
+  Half-edge h belongs to face h / 3 and runs from corner h % 3 to the
+  next corner of that face, so face, next and prev are arithmetic and
+  only twins and one outgoing half-edge per vertex are stored.  Twins
+  are found by radix sorting half-edges on their (lower, higher) vertex
+  pair and pairing neighbours in the sorted order, so building is linear
+  in the mesh size and needs no hashing.  Edges shared by more than two
+  faces, or by two faces of opposite orientation, are left unpaired and
+  behave like boundary edges; manifold() reports whether any were found.
+  Degenerate faces, which repeat a vertex, are left out of the adjacency
+  entirely: none of their half-edges gets a twin or is a vertex's
+  outgoing half-edge, so a collapsed triangle lying along a real edge
+  doesn't unpair the two faces that share it.
+  The structure indexes into the mesh it was built from and has to be
+  rebuilt when that mesh's faces change.
+ */
+class half_edge_mesh {
+public:
+  half_edge_mesh() : num_vertices_(0), manifold_(true) { }
+  /** \brief build the adjacency of a mesh
+    \tparam M - supports mesh concept
+    \param m - mesh to build from
+   */
+  template<typename M>
+  explicit half_edge_mesh(const M &m) {
+    build(m);
+  }
+
+  /** \brief (re)build the adjacency of a mesh
+    \tparam M - supports mesh concept
+    \param m - mesh to build from
+   */
+  template<typename M>
+  void build(const M &m) {
+    num_vertices_ = m.num_vertices();
+    const int nf = m.num_faces();
+    from_.resize(3*nf);
+    for(int f=0; f<nf; ++f) {
+      for(int k=0; k<3; ++k) from_[3*f + k] = m.faces(f)[k];
+    }
+    pair_twins_();
+
+    // prefer a boundary half-edge as a vertex's outgoing one, so walking
+    // its ring from there covers the whole fan
+    outgoing_.assign(num_vertices_, -1);
+    for(int h=0; h<num_half_edges(); ++h) {
+      if(degenerate(face(h))) continue;
+      int &out = outgoing_[from_[h]];
+      if(out < 0 || (twin_[h] < 0 && twin_[out] >= 0)) out = h;
+    }
+  }
+
+  /** \brief number of vertices */
+  inline int num_vertices() const { return num_vertices_; }
+  /** \brief number of faces */
+  inline int num_faces() const { return from_.size() / 3; }
+  /** \brief number of half-edges, three per face */
+  inline int num_half_edges() const { return from_.size(); }
+  /** \brief true unless some edge is shared by more than two faces or
+    by faces of opposite orientation */
+  inline bool manifold() const { return manifold_; }
+
+  /** \brief true if face f repeats a vertex; its half-edges are never
+    paired */
+  inline bool degenerate(int f) const {
+    const int *v = &from_[3*f];
+    return v[0] == v[1] || v[1] == v[2] || v[2] == v[0];
+  }
+
+  /** \brief face a half-edge belongs to */
+  static inline int face(int h) { return h / 3; }
+  /** \brief next half-edge around the same face */
+  static inline int next(int h) { return h % 3 == 2 ? h - 2 : h + 1; }
+  /** \brief previous half-edge around the same face */
+  static inline int prev(int h) { return h % 3 == 0 ? h + 2 : h - 1; }
+  /** \brief opposite half-edge, or -1 on a boundary */
+  inline int twin(int h) const { return twin_[h]; }
+  /** \brief vertex a half-edge starts at */
+  inline int from(int h) const { return from_[h]; }
+  /** \brief vertex a half-edge ends at */
+  inline int to(int h) const { return from_[next(h)]; }
+
+  /** \brief a half-edge leaving v, or -1 if no face uses v; on the
+    boundary it is the boundary half-edge, which starts the ring */
+  inline int outgoing(int v) const { return outgoing_[v]; }
+  /** \brief true if h has no twin */
+  inline bool boundary_edge(int h) const { return twin_[h] < 0; }
+  /** \brief true if v lies on a boundary (or is unused) */
+  inline bool boundary_vertex(int v) const {
+    return outgoing_[v] < 0 || twin_[outgoing_[v]] < 0;
+  }
+
+  /** \brief next half-edge leaving from(h), turning counter-clockwise;
+    -1 at the end of a boundary fan.  Returns outgoing(from(h)) again
+    after a full turn around an interior vertex. */
+  inline int ring_next(int h) const { return twin_[prev(h)]; }
+
+  /** \brief the vertices around v, in ring order
+    Only the fan containing outgoing(v) is visited at a non-manifold
+    vertex.
+    \param v - vertex to visit
+    \param ring - receives the neighbours of v
+   */
+  void one_ring(int v, std::vector<int> &ring) const {
+    ring.clear();
+    const int start = outgoing_[v];
+    if(start < 0) return;
+    int h = start;
+    do {
+      ring.push_back(to(h));
+      const int n = ring_next(h);
+      if(n < 0) {
+        // end of a boundary fan: the last neighbour is only reachable
+        // through the incoming edge
+        ring.push_back(from_[prev(h)]);
+        break;
+      }
+      h = n;
+    } while(h != start);
+  }
+
+  /** \brief the boundary loops of the mesh
+    \param loops - receives one list of half-edges per loop, each
+      ending where the next starts
+   */
+  void boundary_loops(std::vector<std::vector<int> > &loops) const {
+    loops.clear();
+    std::vector<char> visited(num_half_edges(), 0);
+    for(int start=0; start<num_half_edges(); ++start) {
+      if(twin_[start] >= 0 || visited[start] || degenerate(face(start))) {
+        continue;
+      }
+      loops.push_back(std::vector<int>());
+      std::vector<int> &loop = loops.back();
+      int h = start;
+      do {
+        visited[h] = 1;
+        loop.push_back(h);
+        // turn clockwise around to(h) until the next boundary half-edge
+        int g = next(h);
+        while(twin_[g] >= 0) g = next(twin_[g]);
+        h = g;
+      } while(h != start && !visited[h]);
+    }
+  }
+
+private:
+  // one counting sort pass of half-edge ids by key -- don't use this
+  void counting_sort_(const std::vector<int> &keys, std::vector<int> &ids,
+      std::vector<int> &out) const {
+    std::vector<int> offsets(num_vertices_ + 1, 0);
+    for(std::size_t i=0; i<ids.size(); ++i) ++offsets[keys[ids[i]] + 1];
+    for(int v=0; v<num_vertices_; ++v) offsets[v + 1] += offsets[v];
+    out.resize(ids.size());
+    for(std::size_t i=0; i<ids.size(); ++i) {
+      out[offsets[keys[ids[i]]]++] = ids[i];
+    }
+  }
+
+  void pair_twins_() {
+    const int n = num_half_edges();
+    twin_.assign(n, -1);
+    manifold_ = true;
+    std::vector<int> lo(n), hi(n), ids, sorted;
+    ids.reserve(n);
+    for(int h=0; h<n; ++h) {
+      const int a = from_[h], b = to(h);
+      lo[h] = a < b ? a : b;
+      hi[h] = a < b ? b : a;
+      if(!degenerate(face(h))) ids.push_back(h);
+    }
+    // least significant digit first: by higher vertex, then stably by
+    // lower vertex
+    counting_sort_(hi, ids, sorted);
+    counting_sort_(lo, sorted, ids);
+
+    const int m = ids.size();
+    for(int i=0; i<m; ) {
+      int j = i + 1;
+      while(j < m && lo[ids[j]] == lo[ids[i]] && hi[ids[j]] == hi[ids[i]]) {
+        ++j;
+      }
+      const int a = ids[i];
+      if(j - i == 2 && from_[a] == to(ids[i + 1])) {
+        twin_[a] = ids[i + 1];
+        twin_[ids[i + 1]] = a;
+      } else if(j - i > 1) {
+        manifold_ = false;
+      }
+      i = j;
+    }
+  }
+
+  int num_vertices_;
+  bool manifold_;
+  std::vector<int> from_;
+  std::vector<int> twin_;
+  std::vector<int> outgoing_;
+};
+
+}
+
+#endif
+
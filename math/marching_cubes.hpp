@@ -0,0 +1,363 @@
+#ifndef _GHP_MATH_MARCHING_CUBES_HPP_
+#define _GHP_MATH_MARCHING_CUBES_HPP_
+
+#include "vector.hpp"
+#include "vertex_aux.hpp"
+#include "../util/parallel.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+#include <cmath>
+
+namespace ghp {
+
+/*
+  Cube corners are numbered by their offsets, corner i sitting at
+  (i & 1, (i >> 1) & 1, (i >> 2) & 1).  Edges 0-3 run along x, 4-7 along
+  y and 8-11 along z.
+ */
+
+/* the marching cubes case table -- don't use this
+  Rather than carrying the classic hand-made 256 case table, it is
+  derived from two rules: on each cube face the isoline cuts off inside
+  corners separately (so neighbouring cubes always agree and the surface
+  is watertight), and the face segments, oriented with the inside on
+  their left, chain into loops that are fanned into triangles. */
+struct marching_cubes_table_ {
+  enum { max_triangles = 12 };
+
+  marching_cubes_table_() {
+    static const int faces[6][4] = {
+      // counter-clockwise seen from outside the cube
+      { 0, 4, 6, 2 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 },
+      { 2, 6, 7, 3 }, { 0, 2, 3, 1 }, { 4, 5, 7, 6 }
+    };
+    int edge_of[8][8];
+    for(int e=0; e<12; ++e) {
+      const int axis = e / 4;
+      const int low = e % 4;
+      // the corner offsets along the other two axes, in increasing order
+      const int other1 = axis == 0 ? 1 : 0;
+      const int other2 = axis == 2 ? 1 : 2;
+      const int a = ((low & 1) << other1) | ((low >> 1) << other2);
+      const int b = a | (1 << axis);
+      corners[e][0] = a;
+      corners[e][1] = b;
+      edge_of[a][b] = edge_of[b][a] = e;
+    }
+
+    for(int c=0; c<256; ++c) {
+      int next[12];
+      for(int e=0; e<12; ++e) next[e] = -1;
+      for(int f=0; f<6; ++f) {
+        for(int k=0; k<4; ++k) {
+          const int a = faces[f][k], b = faces[f][(k + 1) % 4];
+          if(!(c >> a & 1) || (c >> b & 1)) continue;
+          // an inside-to-outside crossing connects back to the nearest
+          // outside-to-inside crossing before it
+          for(int j=1; j<4; ++j) {
+            const int p = faces[f][(k + 4 - j) % 4];
+            const int q = faces[f][(k + 5 - j) % 4];
+            if(!(c >> p & 1) && (c >> q & 1)) {
+              next[edge_of[a][b]] = edge_of[p][q];
+              break;
+            }
+          }
+        }
+      }
+
+      count[c] = 0;
+      bool visited[12] = { false };
+      for(int e=0; e<12; ++e) {
+        if(next[e] < 0 || visited[e]) continue;
+        int loop[12];
+        int n = 0;
+        for(int i=e; !visited[i]; i=next[i]) {
+          visited[i] = true;
+          loop[n++] = i;
+        }
+        // fan from the corner whose diagonals run through the cube rather
+        // than along a face, where the neighbouring cube might draw the
+        // same diagonal
+        int apex = 0, best = 13;
+        for(int a=0; a<n; ++a) {
+          int on_face = 0;
+          for(int i=2; i+1<n; ++i) {
+            on_face += share_face_(loop[a], loop[(a + i) % n]);
+          }
+          if(on_face < best) {
+            apex = a;
+            best = on_face;
+          }
+        }
+        // reversed fan, so triangles face away from the inside
+        for(int i=1; i+1<n; ++i) {
+          signed char *t = triangles[c][count[c]++];
+          t[0] = loop[apex];
+          t[1] = loop[(apex + i + 1) % n];
+          t[2] = loop[(apex + i) % n];
+        }
+      }
+    }
+  }
+
+  // do two edges lie on a common cube face
+  bool share_face_(int e1, int e2) const {
+    const int shared_in = corners[e1][0] & corners[e1][1]
+      & corners[e2][0] & corners[e2][1];
+    const int shared_out = corners[e1][0] | corners[e1][1]
+      | corners[e2][0] | corners[e2][1];
+    return shared_in != 0 || shared_out != 7;
+  }
+
+  int corners[12][2];
+  int count[256];
+  signed char triangles[256][max_triangles][3];
+};
+
+/* shared state of a marching cubes run -- don't use this */
+struct marching_cubes_volume_ {
+  const float *values;
+  int nx, ny, nz;
+  float iso;
+  vector<3, float> origin;
+  float spacing;
+
+  inline float at(int x, int y, int z) const {
+    return values[x + nx*(y + static_cast<std::size_t>(ny)*z)];
+  }
+  inline bool inside(int x, int y, int z) const { return at(x, y, z) < iso; }
+  inline int cell_case(int x, int y, int z) const {
+    int c = 0;
+    for(int i=0; i<8; ++i) {
+      if(inside(x + (i & 1), y + (i >> 1 & 1), z + (i >> 2 & 1))) c |= 1 << i;
+    }
+    return c;
+  }
+  // does the lattice edge from (x, y, z) along axis cross the surface
+  inline bool crosses(int x, int y, int z, int axis) const {
+    return inside(x, y, z) != inside(x + (axis == 0), y + (axis == 1),
+      z + (axis == 2));
+  }
+  inline vector<3, float> gradient(int x, int y, int z) const {
+    vector<3, float> g;
+    g(0) = (at(x < nx - 1 ? x + 1 : x, y, z) - at(x > 0 ? x - 1 : x, y, z))
+      / ((x < nx - 1) + (x > 0));
+    g(1) = (at(x, y < ny - 1 ? y + 1 : y, z) - at(x, y > 0 ? y - 1 : y, z))
+      / ((y < ny - 1) + (y > 0));
+    g(2) = (at(x, y, z < nz - 1 ? z + 1 : z) - at(x, y, z > 0 ? z - 1 : z))
+      / ((z < nz - 1) + (z > 0));
+    return g;
+  }
+};
+
+/* one slab of cell layers: counts its vertices and triangles, or emits
+  them -- don't use this
+
+  Each lattice edge with a crossing gets one vertex, owned by the slab
+  whose cell layers start at or below the edge's lower end.  The top
+  plane's x and y edges thus belong to the next slab (except in the
+  last slab), and their indices are found by scanning that plane in the
+  order the next slab numbers it, starting from its vertex base.  Every
+  slab numbers its vertices in the order: plane z0's x and y edges, then
+  for each layer z the z edges from z to z + 1 followed by plane z + 1's
+  x and y edges.  So no fixups are needed after the parallel pass. */
+template<typename M>
+struct marching_cubes_slab_ {
+  marching_cubes_slab_(const marching_cubes_table_ &table,
+      const marching_cubes_volume_ &volume, std::size_t num_slabs, M *m)
+    : table_(table), v_(volume), m_(m), vertex_counts(num_slabs, 0),
+      face_counts(num_slabs, 0), vertex_bases(num_slabs + 1, 0),
+      face_bases(num_slabs, 0) { }
+
+  void operator()(std::size_t slab, std::size_t begin, std::size_t end) {
+    const int z0 = begin, z1 = end;
+    const std::size_t plane = static_cast<std::size_t>(v_.nx)*v_.ny;
+    if(m_ == NULL) {
+      // counting pass
+      int vertices = 0, faces = 0;
+      for(int z=z0; z<=z1; ++z) {
+        if(z < z1 || z1 == v_.nz - 1) vertices += count_plane_(z);
+        if(z == z1) break;
+        for(int y=0; y<v_.ny; ++y) {
+          for(int x=0; x<v_.nx; ++x) vertices += v_.crosses(x, y, z, 2);
+        }
+        for(int y=0; y<v_.ny - 1; ++y) {
+          for(int x=0; x<v_.nx - 1; ++x) {
+            faces += table_.count[v_.cell_case(x, y, z)];
+          }
+        }
+      }
+      vertex_counts[slab] = vertices;
+      face_counts[slab] = faces;
+      return;
+    }
+
+    std::vector<int> lower(2*plane), upper(2*plane), vertical(plane);
+    int next_vertex = vertex_bases[slab];
+    int next_face = face_bases[slab];
+    index_plane_(z0, lower, next_vertex, true);
+    for(int z=z0; z<z1; ++z) {
+      for(int y=0; y<v_.ny; ++y) {
+        for(int x=0; x<v_.nx; ++x) {
+          vertical[x + v_.nx*y] = v_.crosses(x, y, z, 2)
+            ? emit_vertex_(x, y, z, 2, next_vertex++) : -1;
+        }
+      }
+      if(z + 1 < z1 || z1 == v_.nz - 1) {
+        index_plane_(z + 1, upper, next_vertex, true);
+      } else {
+        int theirs = vertex_bases[slab + 1];
+        index_plane_(z + 1, upper, theirs, false);
+      }
+
+      for(int y=0; y<v_.ny - 1; ++y) {
+        for(int x=0; x<v_.nx - 1; ++x) {
+          const int c = v_.cell_case(x, y, z);
+          for(int t=0; t<table_.count[c]; ++t) {
+            for(int k=0; k<3; ++k) {
+              const int e = table_.triangles[c][t][k];
+              const int a = table_.corners[e][0];
+              const int ex = x + (a & 1), ey = y + (a >> 1 & 1);
+              const std::size_t i = ex + v_.nx*ey;
+              int index;
+              if(e >= 8) {
+                index = vertical[i];
+              } else {
+                const std::vector<int> &p = (a >> 2 & 1) ? upper : lower;
+                index = p[2*i + (e >= 4)];
+              }
+              m_->faces(next_face)[k] = index;
+            }
+            ++next_face;
+          }
+        }
+      }
+      lower.swap(upper);
+    }
+  }
+
+  int count_plane_(int z) const {
+    int n = 0;
+    for(int y=0; y<v_.ny; ++y) {
+      for(int x=0; x<v_.nx; ++x) {
+        n += (x < v_.nx - 1 && v_.crosses(x, y, z, 0))
+          + (y < v_.ny - 1 && v_.crosses(x, y, z, 1));
+      }
+    }
+    return n;
+  }
+
+  // numbers plane z's x and y edge crossings, emitting their vertices if
+  // this slab owns them
+  void index_plane_(int z, std::vector<int> &ids, int &next, bool emit) {
+    for(int y=0; y<v_.ny; ++y) {
+      for(int x=0; x<v_.nx; ++x) {
+        const std::size_t i = x + v_.nx*y;
+        for(int axis=0; axis<2; ++axis) {
+          const bool valid = axis == 0 ? x < v_.nx - 1 : y < v_.ny - 1;
+          if(valid && v_.crosses(x, y, z, axis)) {
+            ids[2*i + axis] = emit ? emit_vertex_(x, y, z, axis, next++)
+              : next++;
+          } else {
+            ids[2*i + axis] = -1;
+          }
+        }
+      }
+    }
+  }
+
+  int emit_vertex_(int x, int y, int z, int axis, int index) {
+    typedef typename M::vertex_access_t access_t;
+    const int x1 = x + (axis == 0), y1 = y + (axis == 1), z1 = z + (axis == 2);
+    const float a = v_.at(x, y, z), b = v_.at(x1, y1, z1);
+    const float t = (v_.iso - a) / (b - a);
+    vector<3, float> p = vector3<float>(x, y, z);
+    p(axis) += t;
+    vertex_write_loc<access_t>()(m_->vertices(index),
+      v_.origin + p * v_.spacing);
+    vector<3, float> n = v_.gradient(x, y, z) * (1 - t)
+      + v_.gradient(x1, y1, z1) * t;
+    const float len2 = n.norm2();
+    if(len2 > 0) n /= std::sqrt(len2);
+    vertex_write_norm<access_t>()(m_->vertices(index), n);
+    return index;
+  }
+
+  const marching_cubes_table_ &table_;
+  const marching_cubes_volume_ &v_;
+  M *m_;
+  std::vector<int> vertex_counts;
+  std::vector<int> face_counts;
+  std::vector<int> vertex_bases;
+  std::vector<int> face_bases;
+};
+
+/**
+  \brief extract an isosurface from a scalar volume
+  Marching cubes over slabs of cell layers in parallel.  A first pass
+  counts each slab's vertices and triangles; prefix sums of those give
+  every slab fixed ranges of the output, and a second pass writes them.
+  Within a slab, vertices on lattice edges are numbered through rolling
+  per-plane caches so that neighbouring cells, and neighbouring slabs,
+  share them: the output is welded without mesh::compact.  Values below
+  iso are inside; triangles face away from the inside and normals come
+  from the volume's gradient.
+  \tparam M - supports mesh concept
+  \param values - samples, x fastest: values[x + nx*(y + ny*z)]
+  \param nx - number of samples along x
+  \param ny - number of samples along y
+  \param nz - number of samples along z
+  \param iso - isovalue to extract
+  \param m - mesh in which to store result
+  \param origin - location of sample (0, 0, 0)
+  \param spacing - distance between samples
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+  \throws std::runtime_error if the output would have more than 2^31
+    vertices or triangles
+ */
+template<typename M>
+void marching_cubes(const float *values, int nx, int ny, int nz, float iso,
+    M &m, const vector<3, float> &origin = vector<3, float>(),
+    float spacing = 1, unsigned threads = 0) {
+  m.resize_vertices(0);
+  m.resize_faces(0);
+  if(nx < 2 || ny < 2 || nz < 2) return;
+  const marching_cubes_table_ table;
+  marching_cubes_volume_ volume;
+  volume.values = values;
+  volume.nx = nx;
+  volume.ny = ny;
+  volume.nz = nz;
+  volume.iso = iso;
+  volume.origin = origin;
+  volume.spacing = spacing;
+
+  const std::size_t layers = nz - 1;
+  const std::size_t min_layers = 4;
+  const std::size_t slabs = parallel_num_blocks(layers, min_layers, threads);
+  marching_cubes_slab_<M> slab(table, volume, slabs, NULL);
+  parallel_for_blocks(0, layers, slab, min_layers, threads);
+
+  double vertices = 0, faces = 0;
+  for(std::size_t s=0; s<slabs; ++s) {
+    slab.vertex_bases[s] = vertices;
+    slab.face_bases[s] = faces;
+    vertices += slab.vertex_counts[s];
+    faces += slab.face_counts[s];
+  }
+  if(vertices > 2147483647.0 || faces > 2147483647.0) {
+    throw std::runtime_error("isosurface too large for a mesh");
+  }
+  slab.vertex_bases[slabs] = vertices;
+  m.resize_vertices(static_cast<int>(vertices));
+  m.resize_faces(static_cast<int>(faces));
+  slab.m_ = &m;
+  parallel_for_blocks(0, layers, slab, min_layers, threads);
+}
+
+}
+
+#endif
+
@@ -1,17 +1,119 @@
 #ifndef _GHP_MATH_MESH_HPP_
 #define _GHP_MATH_MESH_HPP_
 
+#include "mesh_storage.hpp"
+#include "vector.hpp"
 #include "vertex.hpp"
+#include "../util/parallel.hpp"
 
 #include <vector>
 
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
 namespace ghp {
 
+/**
+  \brief turns vertex attributes into integer keys for welding
+  With a scale of 0 the key is the exact bit pattern of each component
+  (with -0 folded onto +0); otherwise each component is snapped to a grid
+  of spacing 1/scale.
+  \tparam T - scalar attribute type
+ */
+template<typename T>
+struct weld_key_traits {
+  enum { size = 1 };
+  static inline void quantize(const T &t, double scale, int64_t *out) {
+    const double d = static_cast<double>(t) + 0.0;
+    if(scale == 0) {
+      std::memcpy(out, &d, sizeof(d));
+    } else {
+      out[0] = static_cast<int64_t>(std::floor(d*scale + 0.5));
+    }
+  }
+};
+template<int N, typename T>
+struct weld_key_traits<vector<N, T> > {
+  enum { size = N };
+  static inline void quantize(const vector<N, T> &v, double scale,
+      int64_t *out) {
+    for(int i=0; i<N; ++i) {
+      weld_key_traits<T>::quantize(v(i), scale, out + i);
+    }
+  }
+};
+
+/* builds weld keys and hashes for a block of vertices -- don't use this */
+template<typename M>
+struct mesh_weld_keys_ {
+  typedef typename M::const_vertex_access_t access_t;
+  typedef typename M::vertex_t::vector_t vector_t;
+  typedef typename M::vertex_t::uv_t uv_t;
+  enum { vector_size = weld_key_traits<vector_t>::size };
+  enum { uv_size = weld_key_traits<uv_t>::size };
+  enum { size = 2*vector_size + uv_size };
+
+  mesh_weld_keys_(const M &m, double scale, std::vector<int64_t> &keys,
+      std::vector<uint64_t> &hashes)
+    : m_(m), scale_(scale), keys_(keys), hashes_(hashes) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    vector_t vec;
+    uv_t uv = uv_t();
+    for(std::size_t i=begin; i<end; ++i) {
+      int64_t *key = &keys_[i*size];
+      vertex_read_loc<access_t>()(m_.vertices(i), vec);
+      weld_key_traits<vector_t>::quantize(vec, scale_, key);
+      vertex_read_norm<access_t>()(m_.vertices(i), vec);
+      weld_key_traits<vector_t>::quantize(vec, scale_, key + vector_size);
+      vertex_read_uv<access_t>()(m_.vertices(i), uv);
+      weld_key_traits<uv_t>::quantize(uv, scale_, key + 2*vector_size);
+
+      // 64-bit FNV-1a over the key words, finished with a murmur mix
+      uint64_t h = 14695981039346656037ULL;
+      for(int k=0; k<size; ++k) {
+        h = (h ^ static_cast<uint64_t>(key[k])) * 1099511628211ULL;
+      }
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      hashes_[i] = h;
+    }
+  }
+
+  const M &m_;
+  double scale_;
+  std::vector<int64_t> &keys_;
+  std::vector<uint64_t> &hashes_;
+};
+
+/* rewrites face indices through a vertex remap -- don't use this */
+template<typename FACES>
+struct mesh_remap_faces_ {
+  mesh_remap_faces_(FACES &faces, const std::vector<int> &remap)
+    : faces_(faces), remap_(remap) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    for(std::size_t f=begin; f<end; ++f) {
+      for(int v=0; v<3; ++v) {
+        if(faces_[f][v] >= 0) faces_[f][v] = remap_[faces_[f][v]];
+      }
+    }
+  }
+
+  FACES &faces_;
+  const std::vector<int> &remap_;
+};
+
 /**
   \brief a coherent collection of vertices, arranged into faces
   \tparam V - has vertex concept
+  \tparam STORAGE - vertex storage policy; interleaved_storage keeps
+    whole vertex<V> records, stream_storage keeps one stream per
+    attribute.  see mesh_storage.hpp
  */
-template<typename V>
+template<typename V, template<typename> class STORAGE = interleaved_storage>
 class mesh {
 public:
   /**
@@ -39,17 +141,26 @@ public:
     int indices_[3];
   };
 
+  typedef STORAGE<V> storage_t;
   typedef vertex<V> vertex_t;
   typedef face face_t;
+  /** \brief instantiate vertex_write_* adapters with this type */
+  typedef typename storage_t::access_t vertex_access_t;
+  /** \brief instantiate vertex_read_* adapters with this type */
+  typedef typename storage_t::const_access_t const_vertex_access_t;
+  typedef typename storage_t::reference vertex_reference_t;
+  typedef typename storage_t::const_reference const_vertex_reference_t;
 
   /** \brief create a new mesh */
   mesh() { }
   ~mesh() { }
 
   /** \brief element access */
-  inline vertex_t& vertices(int i) { return vertices_[i]; }
+  inline vertex_reference_t vertices(int i) { return vertices_.at(i); }
   /** \brief element access */
-  inline const vertex_t& vertices(int i) const { return vertices_[i]; }
+  inline const_vertex_reference_t vertices(int i) const {
+    return vertices_.at(i);
+  }
   /** \brief element access */
   inline face_t& faces(int i) { return faces_[i]; }
   /** \brief element access */
@@ -63,13 +174,81 @@ public:
   inline void resize_vertices(int i) { vertices_.resize(i); }
   /** \brief allocates sufficient space for an arbitrary number of faces */
   inline void resize_faces(int i) { faces_.resize(i); }
+  /**
+    \brief reorder, duplicate or drop vertices
+    After the call vertex i is what vertex sources[i] was before; face
+    indices are not touched.
+   */
+  inline void gather_vertices(const std::vector<int> &sources) {
+    vertices_.gather(sources);
+  }
+
+  /** \brief the underlying vertex storage, for raw stream access */
+  inline storage_t& storage() { return vertices_; }
+  /** \brief the underlying vertex storage, for raw stream access */
+  inline const storage_t& storage() const { return vertices_; }
+
+  /**
+    \brief consolidate redundant vertices
+    Vertices whose location, normal and uv are identical (or, with a
+    nonzero epsilon, fall in the same epsilon-sized grid cell) are welded
+    into one and face indices are rewritten to match.  Surviving vertices
+    keep their relative order.  Runs in expected linear time using an
+    open-addressing hash table; key generation and face rewriting are
+    split across threads for large meshes.
+    \param epsilon - grid spacing for welding; 0 welds exact matches only
+   */
+  void compact(float epsilon = 0) {
+    typedef mesh_weld_keys_<mesh> keys_fct;
+    const std::size_t n = vertices_.size();
+    if(n == 0) return;
+    const std::size_t parallel_block = 1 << 16;
+
+    std::vector<int64_t> keys(n * keys_fct::size);
+    std::vector<uint64_t> hashes(n);
+    keys_fct make_keys(*this, epsilon > 0 ? 1.0/epsilon : 0.0, keys, hashes);
+    parallel_for_blocks(0, n, make_keys, parallel_block);
+
+    std::size_t capacity = 16;
+    while(capacity < 2*n) capacity <<= 1;
+    const std::size_t mask = capacity - 1;
+    std::vector<int> table(capacity, -1);
+    std::vector<int> remap(n);
+    std::size_t num_unique = 0;
+    for(std::size_t i=0; i<n; ++i) {
+      const int64_t *key = &keys[i * keys_fct::size];
+      std::size_t slot = hashes[i] & mask;
+      for(;;) {
+        const int j = table[slot];
+        if(j < 0) {
+          table[slot] = i;
+          remap[i] = num_unique++;
+          break;
+        }
+        if(hashes[j] == hashes[i] && std::memcmp(key,
+            &keys[j * keys_fct::size], sizeof(int64_t)*keys_fct::size) == 0) {
+          remap[i] = remap[j];
+          break;
+        }
+        slot = (slot + 1) & mask;
+      }
+    }
+    if(num_unique == n) return;
+
+    std::vector<int> sources(num_unique);
+    for(std::size_t i=0, next=0; i<n; ++i) {
+      if(static_cast<std::size_t>(remap[i]) == next) {
+        sources[next++] = i;
+      }
+    }
+    vertices_.gather(sources);
 
-  /** \brief consolidate redundant vertices */
-  void compact() {
+    mesh_remap_faces_<std::vector<face_t> > remap_faces(faces_, remap);
+    parallel_for_blocks(0, faces_.size(), remap_faces, parallel_block);
   }
 
 private:
-  std::vector<vertex_t> vertices_;
+  storage_t vertices_;
   std::vector<face_t> faces_;
 };
 
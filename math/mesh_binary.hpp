@@ -0,0 +1,497 @@
+#ifndef _GHP_MATH_MESH_BINARY_HPP_
+#define _GHP_MATH_MESH_BINARY_HPP_
+
+#include "mesh_util.hpp"
+#include "vector.hpp"
+#include "vertex_aux.hpp"
+#include "../util/endian.hpp"
+#include "../util/mapped_file.hpp"
+
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <sys/stat.h>
+
+namespace ghp {
+
+/*
+  A versioned binary container for meshes, laid out so a mapped file can
+  be used in place:
+
+    header (128 bytes)
+    locations  - num_vertices * 3 floats
+    normals    - num_vertices * 3 floats
+    uvs        - num_vertices * 2 floats
+    indices    - num_faces * 3 uint32s
+
+  Every stream starts on a 64-byte boundary and all values are stored
+  little-endian.  The content hash covers the four streams.
+ */
+
+/** \brief on-disk header of a binary mesh */
+struct mesh_binary_header {
+  enum { current_version = 1 };
+
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t num_vertices;
+  uint64_t num_faces;
+  uint64_t locs_offset;
+  uint64_t norms_offset;
+  uint64_t uvs_offset;
+  uint64_t indices_offset;
+  uint64_t file_size;
+  uint64_t content_hash;
+  /** size and modification time (nanoseconds since the epoch) of the file
+    this was made from, if any */
+  uint64_t source_size;
+  int64_t source_mtime;
+  float bounds_min[3];
+  float bounds_max[3];
+  uint8_t reserved_[128 - 120];
+};
+
+/* hash of a byte range -- don't use this function */
+inline uint64_t mesh_binary_hash_(const void *data, std::size_t size,
+    uint64_t h = 14695981039346656037ULL) {
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  const std::size_t words = size / 8;
+  for(std::size_t i=0; i<words; ++i, p += 8) {
+    uint64_t w;
+    std::memcpy(&w, p, 8);
+    h = (h ^ w) * 1099511628211ULL;
+  }
+  for(std::size_t i=words*8; i<size; ++i, ++p) {
+    h = (h ^ *p) * 1099511628211ULL;
+  }
+  return h;
+}
+
+/* byte swap a stream in place on big-endian hosts -- don't use this */
+template<typename T>
+inline void mesh_binary_to_native_(T *t, std::size_t n) {
+  if(little_endian()) return;
+  for(std::size_t i=0; i<n; ++i) t[i] = ltoh(t[i]);
+}
+
+/* size and modification time of a file, in nanoseconds where the
+  platform reports them; false if it doesn't exist -- don't use this
+  function */
+inline bool mesh_binary_stat_(const std::string &path, uint64_t &size,
+    int64_t &mtime) {
+  struct stat st;
+  if(stat(path.c_str(), &st) != 0) return false;
+  size = st.st_size;
+#if defined(_WIN32)
+  const int64_t nsec = 0;
+#elif defined(__APPLE__)
+  const int64_t nsec = st.st_mtimespec.tv_nsec;
+#else
+  const int64_t nsec = st.st_mtim.tv_nsec;
+#endif
+  mtime = static_cast<int64_t>(st.st_mtime)*1000000000 + nsec;
+  return true;
+}
+
+/** \brief read-only, zero-copy view of a binary mesh file
+  The file is memory mapped and its header validated; the streams are
+  then available as raw pointers into the mapping, suitable for direct
+  GPU upload.  The raw streams are little-endian; on big-endian hosts use
+  load_mesh_binary instead.
+ */
+template<int N=0>
+class mesh_binary_view_ : public boost::noncopyable {
+public:
+  /** \brief map and validate a binary mesh
+    \param path - path of binary mesh
+    \throws std::runtime_error if the file is missing, truncated or not
+      a binary mesh of a supported version
+   */
+  mesh_binary_view_(const std::string &path)
+      : file_(path) {
+    if(file_.size() < sizeof(mesh_binary_header)) {
+      throw std::runtime_error("not a binary mesh: " + path);
+    }
+    std::memcpy(&header_, file_.data(), sizeof(header_));
+    header_.version = ltoh(header_.version);
+    header_.header_size = ltoh(header_.header_size);
+    uint64_t *fields = &header_.num_vertices;
+    for(int i=0; i<9; ++i) fields[i] = ltoh(fields[i]);
+    header_.source_mtime = ltoh(header_.source_mtime);
+    for(int i=0; i<3; ++i) {
+      header_.bounds_min[i] = ltoh(header_.bounds_min[i]);
+      header_.bounds_max[i] = ltoh(header_.bounds_max[i]);
+    }
+
+    if(std::memcmp(header_.magic, "GHPMESH", 8) != 0) {
+      throw std::runtime_error("not a binary mesh: " + path);
+    }
+    if(header_.version != mesh_binary_header::current_version) {
+      throw std::runtime_error("unsupported binary mesh version: " + path);
+    }
+    const uint64_t nv = header_.num_vertices;
+    const uint64_t nf = header_.num_faces;
+    if(header_.file_size != file_.size()
+        || !stream_fits_(header_.locs_offset, nv, 3*sizeof(float))
+        || !stream_fits_(header_.norms_offset, nv, 3*sizeof(float))
+        || !stream_fits_(header_.uvs_offset, nv, 2*sizeof(float))
+        || !stream_fits_(header_.indices_offset, nf, 3*sizeof(uint32_t))) {
+      throw std::runtime_error("truncated binary mesh: " + path);
+    }
+  }
+  ~mesh_binary_view_() { }
+
+  /** \brief header, converted to host byte order */
+  inline const mesh_binary_header& header() const { return header_; }
+  /** \brief number of vertices */
+  inline std::size_t num_vertices() const { return header_.num_vertices; }
+  /** \brief number of triangles */
+  inline std::size_t num_faces() const { return header_.num_faces; }
+  /** \brief xyz location stream */
+  inline const float* locations() const {
+    return stream_<float>(header_.locs_offset);
+  }
+  /** \brief xyz normal stream */
+  inline const float* normals() const {
+    return stream_<float>(header_.norms_offset);
+  }
+  /** \brief uv stream */
+  inline const float* uvs() const {
+    return stream_<float>(header_.uvs_offset);
+  }
+  /** \brief index stream, three per triangle */
+  inline const uint32_t* indices() const {
+    return stream_<uint32_t>(header_.indices_offset);
+  }
+
+  /** \brief recompute the content hash and compare it to the header */
+  bool verify() const {
+    uint64_t h = mesh_binary_hash_(locations(),
+      num_vertices()*3*sizeof(float));
+    h = mesh_binary_hash_(normals(), num_vertices()*3*sizeof(float), h);
+    h = mesh_binary_hash_(uvs(), num_vertices()*2*sizeof(float), h);
+    h = mesh_binary_hash_(indices(), num_faces()*3*sizeof(uint32_t), h);
+    return h == header_.content_hash;
+  }
+
+private:
+  /* whether count elements of elem_size bytes fit at offset; divides
+    rather than multiplies so a corrupt count can't wrap */
+  inline bool stream_fits_(uint64_t offset, uint64_t count,
+      uint64_t elem_size) const {
+    return offset >= sizeof(mesh_binary_header) && offset % 4 == 0
+      && offset <= file_.size()
+      && count <= (file_.size() - offset) / elem_size;
+  }
+  template<typename T>
+  inline const T* stream_(uint64_t offset) const {
+    return reinterpret_cast<const T*>(file_.data() + offset);
+  }
+
+  mapped_file file_;
+  mesh_binary_header header_;
+};
+
+typedef mesh_binary_view_<0> mesh_binary_view;
+
+/**
+  \brief load a binary mesh
+  The streams are copied straight out of the mapped file into the mesh;
+  nothing is parsed.
+  \tparam M - supports mesh concept
+  \param path - path of binary mesh
+  \param m - mesh in which to store result
+  \param verify - check the content hash before loading
+  \throws std::runtime_error if the file is missing, corrupt (including a
+    face index past the last vertex) or not a binary mesh
+ */
+template<typename M>
+void load_mesh_binary(const std::string &path, M &m, bool verify = false) {
+  typedef typename M::vertex_access_t access_t;
+  mesh_binary_view view(path);
+  if(verify && !view.verify()) {
+    throw std::runtime_error("corrupt binary mesh: " + path);
+  }
+  const std::size_t nv = view.num_vertices();
+  const std::size_t nf = view.num_faces();
+  const float *locs = view.locations();
+  const float *norms = view.normals();
+  const float *uvs = view.uvs();
+  const uint32_t *indices = view.indices();
+
+  m.resize_vertices(nv);
+  for(std::size_t i=0; i<nv; ++i) {
+    vector<3, float> v3;
+    vector<2, float> v2;
+    std::memcpy(&v3(0), locs + 3*i, 3*sizeof(float));
+    mesh_binary_to_native_(&v3(0), 3);
+    vertex_write_loc<access_t>()(m.vertices(i), v3);
+    std::memcpy(&v3(0), norms + 3*i, 3*sizeof(float));
+    mesh_binary_to_native_(&v3(0), 3);
+    vertex_write_norm<access_t>()(m.vertices(i), v3);
+    std::memcpy(&v2(0), uvs + 2*i, 2*sizeof(float));
+    mesh_binary_to_native_(&v2(0), 2);
+    vertex_write_uv<access_t>()(m.vertices(i), v2);
+  }
+  m.resize_faces(nf);
+  for(std::size_t f=0; f<nf; ++f) {
+    uint32_t face[3];
+    std::memcpy(face, indices + 3*f, sizeof(face));
+    mesh_binary_to_native_(face, 3);
+    for(int v=0; v<3; ++v) {
+      if(face[v] >= nv) {
+        throw std::runtime_error("corrupt binary mesh: " + path);
+      }
+      m.faces(f)[v] = face[v];
+    }
+  }
+}
+
+/* buffered little-endian stream writer -- don't use this */
+class mesh_binary_writer_ : public boost::noncopyable {
+public:
+  mesh_binary_writer_(const std::string &path,
+      std::size_t buffer_size = 1 << 20)
+      : file_(std::fopen(path.c_str(), "wb")),
+      path_(path),
+      offset_(0),
+      hash_(14695981039346656037ULL) {
+    if(file_ == NULL) {
+      throw std::runtime_error("couldn't open file for writing " + path);
+    }
+    std::setvbuf(file_, NULL, _IOFBF, buffer_size);
+  }
+  ~mesh_binary_writer_() {
+    if(file_ != NULL) std::fclose(file_);
+  }
+
+  template<typename T>
+  void write(const T *t, std::size_t n, bool hash = true) {
+    if(little_endian()) {
+      write_bytes(t, n*sizeof(T), hash);
+    } else {
+      for(std::size_t i=0; i<n; ++i) {
+        const T swapped = hton_recursive<sizeof(T)>()(t[i]);
+        write_bytes(&swapped, sizeof(T), hash);
+      }
+    }
+  }
+  void write_bytes(const void *data, std::size_t size, bool hash) {
+    if(size == 0) return;
+    if(std::fwrite(data, 1, size, file_) != size) {
+      throw std::runtime_error("couldn't write file " + path_);
+    }
+    if(hash) hash_ = mesh_binary_hash_(data, size, hash_);
+    offset_ += size;
+  }
+  void align(std::size_t alignment) {
+    static const char zeros[64] = { 0 };
+    const std::size_t pad = (alignment - offset_ % alignment) % alignment;
+    write_bytes(zeros, pad, false);
+  }
+  void rewind() {
+    if(std::fseek(file_, 0, SEEK_SET) != 0) {
+      throw std::runtime_error("couldn't write file " + path_);
+    }
+  }
+  void close() {
+    const int result = std::fclose(file_);
+    file_ = NULL;
+    if(result != 0) {
+      throw std::runtime_error("couldn't write file " + path_);
+    }
+  }
+  inline uint64_t offset() const { return offset_; }
+  inline uint64_t hash() const { return hash_; }
+
+private:
+  std::FILE *file_;
+  std::string path_;
+  uint64_t offset_;
+  uint64_t hash_;
+};
+
+/* header for a mesh of the given size, streams not yet placed -- don't
+  use this function */
+inline mesh_binary_header mesh_binary_init_header_(uint64_t num_vertices,
+    uint64_t num_faces, uint64_t source_size, int64_t source_mtime) {
+  mesh_binary_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "GHPMESH", 8);
+  header.version = mesh_binary_header::current_version;
+  header.header_size = sizeof(header);
+  header.num_vertices = num_vertices;
+  header.num_faces = num_faces;
+  header.source_size = source_size;
+  header.source_mtime = source_mtime;
+  for(int i=0; i<3; ++i) {
+    header.bounds_min[i] = num_vertices > 0
+      ? std::numeric_limits<float>::max() : 0;
+    header.bounds_max[i] = num_vertices > 0
+      ? -std::numeric_limits<float>::max() : 0;
+  }
+  return header;
+}
+
+/* once all streams are written, go back and fill in the header, then
+  close the file -- don't use this function */
+inline void mesh_binary_finish_(mesh_binary_writer_ &out,
+    mesh_binary_header &header) {
+  header.file_size = out.offset();
+  header.content_hash = out.hash();
+  out.rewind();
+  mesh_binary_header disk = header;
+  if(big_endian()) {
+    disk.version = hton_recursive<4>()(disk.version);
+    disk.header_size = hton_recursive<4>()(disk.header_size);
+    uint64_t *fields = &disk.num_vertices;
+    for(int i=0; i<9; ++i) fields[i] = hton_recursive<8>()(fields[i]);
+    disk.source_mtime = hton_recursive<8>()(disk.source_mtime);
+    for(int i=0; i<3; ++i) {
+      disk.bounds_min[i] = hton_recursive<4>()(disk.bounds_min[i]);
+      disk.bounds_max[i] = hton_recursive<4>()(disk.bounds_max[i]);
+    }
+  }
+  out.write_bytes(&disk, sizeof(disk), false);
+  out.close();
+}
+
+/**
+  \brief save a mesh in the binary mesh format
+  \tparam M - supports mesh concept
+  \param path - path of file to write
+  \param m - mesh to save
+  \param source_size - size of the file m was loaded from, for caching
+  \param source_mtime - modification time of that file in nanoseconds since
+    the epoch, for caching
+  \throws std::runtime_error if the file can't be written
+ */
+template<typename M>
+void save_mesh_binary(const std::string &path, const M &m,
+    uint64_t source_size = 0, int64_t source_mtime = 0) {
+  typedef typename M::const_vertex_access_t access_t;
+  const std::size_t nv = m.num_vertices();
+  const std::size_t nf = m.num_faces();
+  const std::size_t block = 4096;
+
+  mesh_binary_header header = mesh_binary_init_header_(nv, nf,
+    source_size, source_mtime);
+  mesh_binary_writer_ out(path);
+  out.write_bytes(&header, sizeof(header), false);
+
+  // each stream is gathered through the vertex adapters a block at a time
+  std::vector<float> buffer(3*block);
+  out.align(64);
+  header.locs_offset = out.offset();
+  for(std::size_t b=0; b<nv; b+=block) {
+    const std::size_t n = std::min(block, nv - b);
+    for(std::size_t i=0; i<n; ++i) {
+      vector<3, float> v;
+      vertex_read_loc<access_t>()(m.vertices(b + i), v);
+      for(int k=0; k<3; ++k) {
+        buffer[3*i + k] = v(k);
+        header.bounds_min[k] = std::min(header.bounds_min[k], v(k));
+        header.bounds_max[k] = std::max(header.bounds_max[k], v(k));
+      }
+    }
+    out.write(&buffer[0], 3*n);
+  }
+  out.align(64);
+  header.norms_offset = out.offset();
+  for(std::size_t b=0; b<nv; b+=block) {
+    const std::size_t n = std::min(block, nv - b);
+    for(std::size_t i=0; i<n; ++i) {
+      vector<3, float> v;
+      vertex_read_norm<access_t>()(m.vertices(b + i), v);
+      for(int k=0; k<3; ++k) buffer[3*i + k] = v(k);
+    }
+    out.write(&buffer[0], 3*n);
+  }
+  out.align(64);
+  header.uvs_offset = out.offset();
+  for(std::size_t b=0; b<nv; b+=block) {
+    const std::size_t n = std::min(block, nv - b);
+    for(std::size_t i=0; i<n; ++i) {
+      vector<2, float> v;
+      vertex_read_uv<access_t>()(m.vertices(b + i), v);
+      for(int k=0; k<2; ++k) buffer[2*i + k] = v(k);
+    }
+    out.write(&buffer[0], 2*n);
+  }
+  out.align(64);
+  header.indices_offset = out.offset();
+  std::vector<uint32_t> indices(3*block);
+  for(std::size_t b=0; b<nf; b+=block) {
+    const std::size_t n = std::min(block, nf - b);
+    for(std::size_t f=0; f<n; ++f) {
+      for(int v=0; v<3; ++v) indices[3*f + v] = m.faces(b + f)[v];
+    }
+    out.write(&indices[0], 3*n);
+  }
+  mesh_binary_finish_(out, header);
+}
+
+/**
+  \brief load a wavefront OBJ mesh through a binary cache
+  If cache_path holds a binary mesh made from the current version of the
+  OBJ file (same size and nanosecond modification time, where the
+  platform records one), it is loaded directly.
+  Otherwise the OBJ file is parsed and the cache is (re)written; a cache
+  that can't be written is not an error.
+  \tparam M - supports mesh concept
+  \param path - path of OBJ file
+  \param m - mesh in which to store result
+  \param cache_path - binary cache location; defaults to path + ".gmesh"
+  \throws std::runtime_error if the OBJ file can't be read or parsed
+ */
+template<typename M>
+void load_obj_mesh_cached(const std::string &path, M &m,
+    const std::string &cache_path = std::string()) {
+  const std::string cache = cache_path.empty() ? path + ".gmesh"
+    : cache_path;
+  uint64_t source_size;
+  int64_t source_mtime;
+  if(!mesh_binary_stat_(path, source_size, source_mtime)) {
+    throw std::runtime_error("couldn't open file " + path);
+  }
+
+  uint64_t cache_size;
+  int64_t cache_mtime;
+  if(mesh_binary_stat_(cache, cache_size, cache_mtime)) {
+    try {
+      mesh_binary_view view(cache);
+      if(view.header().source_size == source_size
+          && view.header().source_mtime == source_mtime) {
+        load_mesh_binary(cache, m);
+        return;
+      }
+    } catch(const std::runtime_error&) {
+      // stale or damaged cache; fall through and rebuild it
+    }
+  }
+
+  load_obj_mesh(path, m);
+  const std::string tmp = cache + ".tmp";
+  try {
+    save_mesh_binary(tmp, m, source_size, source_mtime);
+    std::remove(cache.c_str());
+    if(std::rename(tmp.c_str(), cache.c_str()) != 0) {
+      std::remove(tmp.c_str());
+    }
+  } catch(const std::runtime_error&) {
+    std::remove(tmp.c_str());
+  }
+}
+
+}
+
+#endif
+
@@ -0,0 +1,525 @@
+#ifndef _GHP_MATH_MESH_FORMATS_HPP_
+#define _GHP_MATH_MESH_FORMATS_HPP_
+
+#include "mesh_normals.hpp"
+#include "vector.hpp"
+#include "vertex_aux.hpp"
+#include "../util/endian.hpp"
+#include "../util/mapped_file.hpp"
+#include "../util/parallel.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+namespace ghp {
+
+/*
+  Loaders for binary STL and binary PLY.  Both formats are arrays of
+  fixed-size records behind a short header, so the file is mapped and
+  records are copied straight out of it (byte swapped where the file's
+  byte order differs from the host's) rather than parsed.
+ */
+
+/* copies binary STL facets into a mesh -- don't use this */
+template<typename M>
+struct stl_write_facets_ {
+  stl_write_facets_(const char *records, M &m)
+    : records_(records), m_(m) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    typedef typename M::vertex_access_t access_t;
+    for(std::size_t f=begin; f<end; ++f) {
+      // normal, three corners, 16-bit attribute count: 50 bytes, so
+      // records aren't aligned and have to be copied out
+      float values[12];
+      std::memcpy(values, records_ + 50*f, sizeof(values));
+      for(int i=0; i<12; ++i) values[i] = ltoh(values[i]);
+      vector<3, float> n = vector3<float>(values[0], values[1], values[2]);
+      vector<3, float> p[3];
+      for(int v=0; v<3; ++v) {
+        p[v] = vector3<float>(values[3 + 3*v], values[4 + 3*v],
+          values[5 + 3*v]);
+      }
+      if(n.norm2() == 0) {
+        const vector<3, float> e1 = p[1] - p[0], e2 = p[2] - p[0];
+        n = vector3<float>(e1(1)*e2(2) - e1(2)*e2(1),
+          e1(2)*e2(0) - e1(0)*e2(2), e1(0)*e2(1) - e1(1)*e2(0));
+        if(n.norm2() > 0) n /= std::sqrt(n.norm2());
+      }
+      for(int v=0; v<3; ++v) {
+        vertex_write_loc<access_t>()(m_.vertices(3*f + v), p[v]);
+        vertex_write_norm<access_t>()(m_.vertices(3*f + v), n);
+        m_.faces(f)[v] = 3*f + v;
+      }
+    }
+  }
+
+  const char *records_;
+  M &m_;
+};
+
+/**
+  \brief load a binary STL mesh
+  Every facet gets its own three vertices carrying the facet normal.
+  With weld, vertices are then merged by location (see mesh::compact)
+  and given smooth normals instead.
+  \tparam M - supports mesh concept
+  \param path - path of file to load
+  \param m - mesh in which to store result
+  \param weld - merge vertices and smooth normals
+  \param epsilon - distance within which weld merges vertices
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+  \throws std::runtime_error if the file can't be read or isn't a binary
+    STL file
+ */
+template<typename M>
+void load_stl_mesh(const std::string &path, M &m, bool weld = false,
+    float epsilon = 0, unsigned threads = 0) {
+  typedef typename M::vertex_access_t access_t;
+  mapped_file file(path);
+  uint32_t count = 0;
+  if(file.size() >= 84) {
+    std::memcpy(&count, file.data() + 80, sizeof(count));
+    count = ltoh(count);
+  }
+  if(file.size() < 84 || file.size() != 84 + 50*static_cast<uint64_t>(count)) {
+    if(file.size() >= 5 && std::memcmp(file.data(), "solid", 5) == 0) {
+      throw std::runtime_error("ASCII STL files are not supported " + path);
+    }
+    throw std::runtime_error("couldn't understand STL file " + path);
+  }
+
+  m.resize_vertices(3*static_cast<std::size_t>(count));
+  m.resize_faces(count);
+  stl_write_facets_<M> write(file.data() + 84, m);
+  parallel_for_blocks(0, count, write, 1 << 14, threads);
+
+  if(weld) {
+    const vector<3, float> zero;
+    for(int i=0; i<m.num_vertices(); ++i) {
+      vertex_write_norm<access_t>()(m.vertices(i), zero);
+    }
+    m.compact(epsilon);
+    compute_smooth_normals(m, normal_weight_angle, true, threads);
+  }
+}
+
+/* binary PLY scalar types -- don't use this */
+enum ply_type_ {
+  ply_int8_, ply_uint8_, ply_int16_, ply_uint16_, ply_int32_, ply_uint32_,
+  ply_float32_, ply_float64_, ply_invalid_
+};
+
+/* type from its PLY name -- don't use this function */
+inline ply_type_ ply_parse_type_(const std::string &name) {
+  if(name == "char" || name == "int8") return ply_int8_;
+  if(name == "uchar" || name == "uint8") return ply_uint8_;
+  if(name == "short" || name == "int16") return ply_int16_;
+  if(name == "ushort" || name == "uint16") return ply_uint16_;
+  if(name == "int" || name == "int32") return ply_int32_;
+  if(name == "uint" || name == "uint32") return ply_uint32_;
+  if(name == "float" || name == "float32") return ply_float32_;
+  if(name == "double" || name == "float64") return ply_float64_;
+  return ply_invalid_;
+}
+
+/* size of a PLY scalar type in bytes -- don't use this function */
+inline std::size_t ply_type_size_(ply_type_ type) {
+  static const std::size_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+  return sizes[type];
+}
+
+/* read one scalar, converting byte order if swap -- don't use this */
+inline double ply_read_(const char *p, ply_type_ type, bool swap) {
+  switch(type) {
+  case ply_int8_: return *reinterpret_cast<const int8_t*>(p);
+  case ply_uint8_: return *reinterpret_cast<const uint8_t*>(p);
+  default: break;
+  }
+  union {
+    int16_t i16; uint16_t u16; int32_t i32; uint32_t u32; float f32;
+    double f64;
+  } value;
+  const std::size_t size = ply_type_size_(type);
+  std::memcpy(&value, p, size);
+  if(swap) {
+    if(size == 2) value.u16 = hton_recursive<2>()(value.u16);
+    if(size == 4) value.u32 = hton_recursive<4>()(value.u32);
+    if(size == 8) value.f64 = hton_recursive<8>()(value.f64);
+  }
+  switch(type) {
+  case ply_int16_: return value.i16;
+  case ply_uint16_: return value.u16;
+  case ply_int32_: return value.i32;
+  case ply_uint32_: return value.u32;
+  case ply_float32_: return value.f32;
+  default: return value.f64;
+  }
+}
+
+/* read a list length at p, checking that the length field and that many
+  values of the given type fit before end -- don't use this function */
+inline std::size_t ply_read_count_(const char *p, const char *end,
+    ply_type_ count_type, ply_type_ type, bool swap) {
+  const std::size_t count_size = ply_type_size_(count_type);
+  if(static_cast<std::size_t>(end - p) < count_size) {
+    throw std::runtime_error("couldn't understand PLY file (truncated)");
+  }
+  const double count = ply_read_(p, count_type, swap);
+  const double limit = static_cast<double>(
+    (end - p - count_size) / ply_type_size_(type));
+  if(!(count >= 0) || count != std::floor(count)) {
+    throw std::runtime_error("couldn't understand PLY file (bad list)");
+  }
+  if(count > limit) {
+    throw std::runtime_error("couldn't understand PLY file (truncated)");
+  }
+  return static_cast<std::size_t>(count);
+}
+
+/* read a face index, checking it names one of num_vertices vertices
+  before it becomes an int -- don't use this function */
+inline int ply_read_index_(const char *p, ply_type_ type, bool swap,
+    uint64_t num_vertices) {
+  const double index = ply_read_(p, type, swap);
+  const double limit = static_cast<double>(std::min<uint64_t>(num_vertices,
+    std::numeric_limits<int>::max()));
+  if(!(index >= 0 && index < limit) || index != std::floor(index)) {
+    throw std::runtime_error("couldn't understand PLY file (bad index)");
+  }
+  return static_cast<int>(index);
+}
+
+/* one property of a PLY element -- don't use this */
+struct ply_property_ {
+  std::string name;
+  ply_type_ type;
+  /* ply_invalid_ unless this is a list, then the type of its length */
+  ply_type_ count_type;
+  /* offset in the record, for fixed-size records */
+  std::size_t offset;
+};
+
+/* one element of a PLY file -- don't use this */
+struct ply_element_ {
+  std::string name;
+  uint64_t count;
+  std::vector<ply_property_> properties;
+  /* record size, or 0 if the element has list properties */
+  std::size_t stride;
+
+  int find(const std::string &name) const {
+    for(std::size_t i=0; i<properties.size(); ++i) {
+      if(properties[i].name == name) return i;
+    }
+    return -1;
+  }
+};
+
+/* parse a PLY header, returning the start of the body -- don't use this
+  function */
+inline const char* ply_parse_header_(const char *begin, const char *end,
+    std::vector<ply_element_> &elements, bool &swap) {
+  static const char terminator[] = "end_header";
+  const char *p = begin;
+  std::string text;
+  for(;;) {
+    const char *eol = static_cast<const char*>(
+      std::memchr(p, '\n', end - p));
+    if(eol == NULL) {
+      throw std::runtime_error("couldn't understand PLY file (no header)");
+    }
+    std::string line(p, eol);
+    p = eol + 1;
+    if(!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    if(line == terminator) break;
+    text += line;
+    text += '\n';
+  }
+
+  std::istringstream in(text);
+  std::string line;
+  bool have_format = false;
+  std::getline(in, line);
+  if(line != "ply") {
+    throw std::runtime_error("couldn't understand PLY file (bad magic)");
+  }
+  while(std::getline(in, line)) {
+    std::istringstream words(line);
+    std::string keyword;
+    words >> keyword;
+    if(keyword == "format") {
+      std::string format;
+      words >> format;
+      if(format == "binary_little_endian") {
+        swap = big_endian();
+      } else if(format == "binary_big_endian") {
+        swap = little_endian();
+      } else {
+        throw std::runtime_error("only binary PLY files are supported");
+      }
+      have_format = true;
+    } else if(keyword == "element") {
+      ply_element_ e;
+      words >> e.name >> e.count;
+      e.stride = 0;
+      elements.push_back(e);
+    } else if(keyword == "property") {
+      if(elements.empty()) {
+        throw std::runtime_error(
+          "couldn't understand PLY file (property outside element)");
+      }
+      ply_property_ prop;
+      std::string type;
+      words >> type;
+      prop.count_type = ply_invalid_;
+      if(type == "list") {
+        std::string count_type;
+        words >> count_type >> type;
+        prop.count_type = ply_parse_type_(count_type);
+        if(prop.count_type == ply_invalid_) {
+          throw std::runtime_error("couldn't understand PLY file (bad type)");
+        }
+      }
+      prop.type = ply_parse_type_(type);
+      words >> prop.name;
+      if(prop.type == ply_invalid_ || !words) {
+        throw std::runtime_error("couldn't understand PLY file (bad type)");
+      }
+      elements.back().properties.push_back(prop);
+    }
+    // comment, obj_info and unknown keywords are ignored
+  }
+  if(!have_format) {
+    throw std::runtime_error("couldn't understand PLY file (no format)");
+  }
+
+  for(std::size_t i=0; i<elements.size(); ++i) {
+    ply_element_ &e = elements[i];
+    std::size_t offset = 0;
+    bool fixed = true;
+    for(std::size_t j=0; j<e.properties.size(); ++j) {
+      e.properties[j].offset = offset;
+      if(e.properties[j].count_type != ply_invalid_) fixed = false;
+      offset += ply_type_size_(e.properties[j].type);
+    }
+    e.stride = fixed ? offset : 0;
+  }
+  return p;
+}
+
+/* end of an element's records, for skipping it -- don't use this */
+inline const char* ply_skip_element_(const char *p, const char *end,
+    const ply_element_ &e, bool swap) {
+  if(e.stride != 0) {
+    if(static_cast<uint64_t>(end - p) / e.stride < e.count) {
+      throw std::runtime_error("couldn't understand PLY file (truncated)");
+    }
+    return p + e.stride*e.count;
+  }
+  for(uint64_t r=0; r<e.count; ++r) {
+    for(std::size_t j=0; j<e.properties.size(); ++j) {
+      const ply_property_ &prop = e.properties[j];
+      std::size_t size = ply_type_size_(prop.type);
+      if(prop.count_type != ply_invalid_) {
+        size = ply_type_size_(prop.count_type) + size
+          * ply_read_count_(p, end, prop.count_type, prop.type, swap);
+      }
+      if(static_cast<std::size_t>(end - p) < size) {
+        throw std::runtime_error("couldn't understand PLY file (truncated)");
+      }
+      p += size;
+    }
+  }
+  return p;
+}
+
+/* copies fixed-size PLY vertex records into a mesh -- don't use this */
+template<typename M>
+struct ply_write_vertices_ {
+  ply_write_vertices_(const char *records, const ply_element_ &e,
+      const int *props, bool swap, M &m)
+    : records_(records), e_(e), props_(props), swap_(swap), m_(m) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    typedef typename M::vertex_access_t access_t;
+    float values[8];
+    for(std::size_t i=begin; i<end; ++i) {
+      const char *record = records_ + e_.stride*i;
+      for(int k=0; k<8; ++k) {
+        const ply_property_ *prop = props_[k] >= 0
+          ? &e_.properties[props_[k]] : NULL;
+        if(prop == NULL) {
+          values[k] = 0;
+        } else if(prop->type == ply_float32_ && !swap_) {
+          std::memcpy(&values[k], record + prop->offset, sizeof(float));
+        } else {
+          values[k] = ply_read_(record + prop->offset, prop->type, swap_);
+        }
+      }
+      vertex_write_loc<access_t>()(m_.vertices(i),
+        vector3<float>(values[0], values[1], values[2]));
+      vertex_write_norm<access_t>()(m_.vertices(i),
+        vector3<float>(values[3], values[4], values[5]));
+      vector<2, float> uv;
+      uv(0) = values[6];
+      uv(1) = values[7];
+      vertex_write_uv<access_t>()(m_.vertices(i), uv);
+    }
+  }
+
+  const char *records_;
+  const ply_element_ &e_;
+  const int *props_;
+  bool swap_;
+  M &m_;
+};
+
+/**
+  \brief load a binary PLY mesh
+  Reads the vertex element's x, y, z, nx, ny, nz and u, v (or s, t, or
+  texture_u, texture_v) properties, whatever their types, and the face
+  element's vertex_indices (or vertex_index) list; polygons are
+  fan-triangulated and other elements are skipped.  Both binary byte
+  orders are supported.  Vertex records have a fixed size, so they are
+  copied on several threads.
+  \tparam M - supports mesh concept
+  \param path - path of file to load
+  \param m - mesh in which to store result
+  \param weld - merge duplicate vertices afterwards (see mesh::compact)
+  \param epsilon - distance within which weld merges vertices
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+  \throws std::runtime_error if the file can't be read or isn't a binary
+    PLY file with vertices
+ */
+template<typename M>
+void load_ply_mesh(const std::string &path, M &m, bool weld = false,
+    float epsilon = 0, unsigned threads = 0) {
+  mapped_file file(path);
+  if(file.size() == 0) {
+    throw std::runtime_error("couldn't understand PLY file " + path);
+  }
+  std::vector<ply_element_> elements;
+  bool swap = false;
+  const char *p = ply_parse_header_(file.data(), file.end(), elements, swap);
+  const char *end = file.end();
+
+  // faces may come before vertices, so indices are checked against the
+  // count the header declares
+  uint64_t num_vertices = 0;
+  for(std::size_t i=0; i<elements.size(); ++i) {
+    if(elements[i].name == "vertex") num_vertices = elements[i].count;
+  }
+
+  bool have_vertices = false;
+  std::vector<int> indices;
+  for(std::size_t i=0; i<elements.size(); ++i) {
+    const ply_element_ &e = elements[i];
+    if(e.name == "vertex") {
+      if(e.stride == 0) {
+        throw std::runtime_error(
+          "couldn't understand PLY file (list property on vertices)");
+      }
+      static const char * const names[8][3] = {
+        { "x", "x", "x" }, { "y", "y", "y" }, { "z", "z", "z" },
+        { "nx", "nx", "nx" }, { "ny", "ny", "ny" }, { "nz", "nz", "nz" },
+        { "u", "s", "texture_u" }, { "v", "t", "texture_v" }
+      };
+      int props[8];
+      for(int k=0; k<8; ++k) {
+        props[k] = -1;
+        for(int n=0; n<3 && props[k] < 0; ++n) props[k] = e.find(names[k][n]);
+        if(props[k] >= 0
+            && e.properties[props[k]].count_type != ply_invalid_) {
+          props[k] = -1;
+        }
+      }
+      if(props[0] < 0 || props[1] < 0 || props[2] < 0) {
+        throw std::runtime_error(
+          "couldn't understand PLY file (no vertex locations)");
+      }
+      const char *records = p;
+      p = ply_skip_element_(p, end, e, swap);
+      m.resize_vertices(e.count);
+      ply_write_vertices_<M> write(records, e, props, swap, m);
+      parallel_for_blocks(0, e.count, write, 1 << 14, threads);
+      have_vertices = true;
+    } else if(e.name == "face") {
+      int list = e.find("vertex_indices");
+      if(list < 0) list = e.find("vertex_index");
+      if(list < 0 || e.properties[list].count_type == ply_invalid_) {
+        p = ply_skip_element_(p, end, e, swap);
+        continue;
+      }
+      // face records can vary in size, so they are walked in order
+      indices.reserve(3*e.count);
+      for(uint64_t r=0; r<e.count; ++r) {
+        for(std::size_t j=0; j<e.properties.size(); ++j) {
+          const ply_property_ &prop = e.properties[j];
+          const std::size_t size = ply_type_size_(prop.type);
+          std::size_t count = 1;
+          if(prop.count_type != ply_invalid_) {
+            count = ply_read_count_(p, end, prop.count_type, prop.type, swap);
+            p += ply_type_size_(prop.count_type);
+          }
+          if(static_cast<std::size_t>(end - p) / size < count) {
+            throw std::runtime_error(
+              "couldn't understand PLY file (truncated)");
+          }
+          if(static_cast<int>(j) == list) {
+            if(count < 3) {
+              throw std::runtime_error("couldn't understand PLY file "
+                "(face with fewer than 3 corners)");
+            }
+            const int first = ply_read_index_(p, prop.type, swap,
+              num_vertices);
+            int prev = ply_read_index_(p + size, prop.type, swap,
+              num_vertices);
+            for(std::size_t c=2; c<count; ++c) {
+              const int cur = ply_read_index_(p + c*size, prop.type, swap,
+                num_vertices);
+              indices.push_back(first);
+              indices.push_back(prev);
+              indices.push_back(cur);
+              prev = cur;
+            }
+          }
+          p += count*size;
+        }
+      }
+    } else {
+      p = ply_skip_element_(p, end, e, swap);
+    }
+  }
+  if(!have_vertices) {
+    throw std::runtime_error("couldn't understand PLY file (no vertices)");
+  }
+
+  const int nv = m.num_vertices();
+  m.resize_faces(indices.size() / 3);
+  for(std::size_t f=0; f<indices.size() / 3; ++f) {
+    for(int v=0; v<3; ++v) {
+      const int index = indices[3*f + v];
+      if(index < 0 || index >= nv) {
+        throw std::runtime_error("couldn't understand PLY file (bad index)");
+      }
+      m.faces(f)[v] = index;
+    }
+  }
+  if(weld) m.compact(epsilon);
+}
+
+}
+
+#endif
+
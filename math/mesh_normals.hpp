@@ -0,0 +1,356 @@
+#ifndef _GHP_MATH_MESH_NORMALS_HPP_
+#define _GHP_MATH_MESH_NORMALS_HPP_
+
+#include "vector.hpp"
+#include "vertex_aux.hpp"
+#include "../util/parallel.hpp"
+
+#include <vector>
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+namespace ghp {
+
+/** \brief how face normals are weighted when averaged at a vertex */
+enum normal_weighting {
+  /** every incident face counts the same */
+  normal_weight_uniform,
+  /** faces count in proportion to their area */
+  normal_weight_area,
+  /** faces count in proportion to their corner angle at the vertex */
+  normal_weight_angle
+};
+
+/*
+  Both passes below gather per-face contributions into per-vertex sums.
+  To stay race-free without atomics, each worker thread accumulates its
+  block of faces into a private set of sums; a second pass over vertices
+  adds the partial sums together and normalizes.  Sums are kept as one
+  float array per component so the reduction and normalization loops are
+  straight-line code the compiler can vectorize.
+ */
+
+/* map each vertex to the first vertex sharing its exact location --
+  don't use this function */
+template<typename M>
+void mesh_position_classes_(const M &m, std::vector<int> &classes) {
+  typedef typename M::const_vertex_access_t access_t;
+  const int nv = m.num_vertices();
+  classes.resize(nv);
+  std::size_t capacity = 16;
+  while(capacity < 2*static_cast<std::size_t>(nv)) capacity <<= 1;
+  std::vector<int> table(capacity, -1);
+  std::vector<vector<3, float> > locs(nv);
+  for(int i=0; i<nv; ++i) {
+    vertex_read_loc<access_t>()(m.vertices(i), locs[i]);
+    uint32_t bits[3];
+    for(int k=0; k<3; ++k) {
+      const float f = locs[i](k) + 0.0f; // fold -0 onto +0
+      std::memcpy(&bits[k], &f, sizeof(f));
+    }
+    uint64_t h = bits[0] * 0x9E3779B97F4A7C15ULL;
+    h ^= bits[1] * 0xC2B2AE3D27D4EB4FULL;
+    h ^= bits[2] * 0x165667B19E3779F9ULL;
+    h ^= h >> 29;
+    std::size_t slot = h & (capacity - 1);
+    for(;;) {
+      const int j = table[slot];
+      if(j < 0) {
+        table[slot] = classes[i] = i;
+        break;
+      }
+      if(locs[j](0) == locs[i](0) && locs[j](1) == locs[i](1)
+          && locs[j](2) == locs[i](2)) {
+        classes[i] = j;
+        break;
+      }
+      slot = (slot + 1) & (capacity - 1);
+    }
+  }
+}
+
+/* per-thread accumulation of weighted face normals -- don't use this */
+template<typename M>
+struct mesh_accumulate_normals_ {
+  typedef typename M::const_vertex_access_t access_t;
+
+  mesh_accumulate_normals_(const M &m, const std::vector<int> &classes,
+      normal_weighting weighting, std::vector<float> &partials)
+    : m_(m), classes_(classes), weighting_(weighting), partials_(partials),
+      nv_(m.num_vertices()) { }
+
+  void operator()(std::size_t block, std::size_t begin, std::size_t end) {
+    float *sum = &partials_[3*nv_*block];
+    for(std::size_t f=begin; f<end; ++f) {
+      vector<3, float> p[3];
+      for(int v=0; v<3; ++v) {
+        vertex_read_loc<access_t>()(m_.vertices(m_.faces(f)[v]), p[v]);
+      }
+      const vector<3, float> e1 = p[1] - p[0];
+      const vector<3, float> e2 = p[2] - p[0];
+      // |cross| is twice the area, so it is already area weighted
+      vector<3, float> n = vector3<float>(
+        e1(1)*e2(2) - e1(2)*e2(1),
+        e1(2)*e2(0) - e1(0)*e2(2),
+        e1(0)*e2(1) - e1(1)*e2(0));
+      const float len2 = n.norm2();
+      if(len2 == 0) continue;
+      if(weighting_ != normal_weight_area) n /= std::sqrt(len2);
+
+      for(int v=0; v<3; ++v) {
+        float w = 1;
+        if(weighting_ == normal_weight_angle) {
+          vector<3, float> a = p[(v + 1) % 3] - p[v];
+          vector<3, float> b = p[(v + 2) % 3] - p[v];
+          const float la = a.norm2(), lb = b.norm2();
+          if(la == 0 || lb == 0) continue;
+          float c = inner_prod(a, b) / std::sqrt(la*lb);
+          c = c < -1 ? -1 : (c > 1 ? 1 : c);
+          w = std::acos(c);
+        }
+        const int i = classes_[m_.faces(f)[v]];
+        sum[i] += w*n(0);
+        sum[nv_ + i] += w*n(1);
+        sum[2*nv_ + i] += w*n(2);
+      }
+    }
+  }
+
+  const M &m_;
+  const std::vector<int> &classes_;
+  normal_weighting weighting_;
+  std::vector<float> &partials_;
+  std::size_t nv_;
+};
+
+/* sums per-thread partials into the first set -- don't use this */
+struct mesh_reduce_partials_ {
+  mesh_reduce_partials_(std::vector<float> &partials, std::size_t stride,
+      std::size_t num_partials)
+    : partials_(partials), stride_(stride), num_partials_(num_partials) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    float *out = &partials_[0];
+    for(std::size_t p=1; p<num_partials_; ++p) {
+      const float *in = &partials_[p*stride_];
+      for(std::size_t i=begin; i<end; ++i) out[i] += in[i];
+    }
+  }
+
+  std::vector<float> &partials_;
+  std::size_t stride_;
+  std::size_t num_partials_;
+};
+
+/* normalizes 3-component sums in place -- don't use this */
+struct mesh_normalize_sums_ {
+  mesh_normalize_sums_(float *x, float *y, float *z)
+    : x_(x), y_(y), z_(z) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    float * const x = x_;
+    float * const y = y_;
+    float * const z = z_;
+    for(std::size_t i=begin; i<end; ++i) {
+      const float len2 = x[i]*x[i] + y[i]*y[i] + z[i]*z[i];
+      const float scale = len2 > 0 ? 1.0f / std::sqrt(len2) : 0.0f;
+      x[i] *= scale;
+      y[i] *= scale;
+      z[i] *= scale;
+    }
+  }
+
+  float *x_;
+  float *y_;
+  float *z_;
+};
+
+/**
+  \brief recompute smooth per-vertex normals
+  Each face's normal is added to its corners, weighted by the chosen
+  scheme, and the sums are normalized.  With smooth_seams, vertices that
+  share a location (split only for uvs or normals) share one sum, so
+  the result is smooth across seams.  Faces are split across threads,
+  each accumulating into private sums that are combined afterwards.
+  \tparam M - supports mesh concept
+  \param m - mesh whose normals are rewritten
+  \param weighting - how incident faces are weighted
+  \param smooth_seams - average across vertices at the same location
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+ */
+template<typename M>
+void compute_smooth_normals(M &m,
+    normal_weighting weighting = normal_weight_angle,
+    bool smooth_seams = true, unsigned threads = 0) {
+  typedef typename M::vertex_access_t access_t;
+  const std::size_t nv = m.num_vertices();
+  const std::size_t nf = m.num_faces();
+  if(nv == 0) return;
+  const std::size_t min_block = 1 << 15;
+
+  std::vector<int> classes;
+  if(smooth_seams) {
+    mesh_position_classes_(m, classes);
+  } else {
+    classes.resize(nv);
+    for(std::size_t i=0; i<nv; ++i) classes[i] = i;
+  }
+
+  const std::size_t blocks = parallel_num_blocks(nf, min_block, threads);
+  std::vector<float> partials(3*nv*blocks, 0.0f);
+  mesh_accumulate_normals_<M> accumulate(m, classes, weighting, partials);
+  parallel_for_blocks(0, nf, accumulate, min_block, threads);
+  mesh_reduce_partials_ reduce(partials, 3*nv, blocks);
+  parallel_for_blocks(0, 3*nv, reduce, min_block, threads);
+  mesh_normalize_sums_ normalize(&partials[0], &partials[nv],
+    &partials[2*nv]);
+  parallel_for_blocks(0, nv, normalize, min_block, threads);
+
+  for(std::size_t i=0; i<nv; ++i) {
+    const int c = classes[i];
+    vertex_write_norm<access_t>()(m.vertices(i),
+      vector3<float>(partials[c], partials[nv + c], partials[2*nv + c]));
+  }
+}
+
+/* per-thread accumulation of face tangent frames -- don't use this */
+template<typename M>
+struct mesh_accumulate_tangents_ {
+  typedef typename M::const_vertex_access_t access_t;
+
+  mesh_accumulate_tangents_(const M &m, std::vector<float> &partials)
+    : m_(m), partials_(partials), nv_(m.num_vertices()) { }
+
+  void operator()(std::size_t block, std::size_t begin, std::size_t end) {
+    float *sum = &partials_[6*nv_*block];
+    for(std::size_t f=begin; f<end; ++f) {
+      vector<3, float> p[3];
+      vector<2, float> uv[3];
+      for(int v=0; v<3; ++v) {
+        vertex_read_loc<access_t>()(m_.vertices(m_.faces(f)[v]), p[v]);
+        vertex_read_uv<access_t>()(m_.vertices(m_.faces(f)[v]), uv[v]);
+      }
+      const vector<3, float> e1 = p[1] - p[0];
+      const vector<3, float> e2 = p[2] - p[0];
+      const float s1 = uv[1](0) - uv[0](0), t1 = uv[1](1) - uv[0](1);
+      const float s2 = uv[2](0) - uv[0](0), t2 = uv[2](1) - uv[0](1);
+      const float det = s1*t2 - s2*t1;
+      if(det == 0) continue;
+      // like MikkTSpace, the uv orientation only contributes a sign here;
+      // magnitudes come from the normalized directions and corner angles
+      const float r = det > 0 ? 1.0f : -1.0f;
+      vector<3, float> t = (e1*t2 - e2*t1) * r;
+      vector<3, float> b = (e2*s1 - e1*s2) * r;
+      const float lt = t.norm2(), lb = b.norm2();
+      if(lt == 0 || lb == 0) continue;
+      t /= std::sqrt(lt);
+      b /= std::sqrt(lb);
+
+      for(int v=0; v<3; ++v) {
+        vector<3, float> a = p[(v + 1) % 3] - p[v];
+        vector<3, float> c = p[(v + 2) % 3] - p[v];
+        const float la = a.norm2(), lc = c.norm2();
+        if(la == 0 || lc == 0) continue;
+        float cosine = inner_prod(a, c) / std::sqrt(la*lc);
+        cosine = cosine < -1 ? -1 : (cosine > 1 ? 1 : cosine);
+        const float w = std::acos(cosine);
+        const int i = m_.faces(f)[v];
+        for(int k=0; k<3; ++k) {
+          sum[k*nv_ + i] += w*t(k);
+          sum[(3 + k)*nv_ + i] += w*b(k);
+        }
+      }
+    }
+  }
+
+  const M &m_;
+  std::vector<float> &partials_;
+  std::size_t nv_;
+};
+
+/* orthonormalizes summed tangents against vertex normals -- don't use
+  this */
+template<typename M>
+struct mesh_finish_tangents_ {
+  typedef typename M::const_vertex_access_t access_t;
+
+  mesh_finish_tangents_(const M &m, const std::vector<float> &sums,
+      std::vector<vector<4, float> > &tangents)
+    : m_(m), sums_(sums), tangents_(tangents), nv_(m.num_vertices()) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    for(std::size_t i=begin; i<end; ++i) {
+      vector<3, float> n, t, b;
+      vertex_read_norm<access_t>()(m_.vertices(i), n);
+      for(int k=0; k<3; ++k) {
+        t(k) = sums_[k*nv_ + i];
+        b(k) = sums_[(3 + k)*nv_ + i];
+      }
+      // Gram-Schmidt against the normal
+      t -= n * inner_prod(n, t);
+      float len2 = t.norm2();
+      if(len2 <= 1e-20f) {
+        // no usable uv gradient: any direction perpendicular to n will do
+        t = std::fabs(n(0)) < 0.9f ? vector3<float>(1, 0, 0)
+          : vector3<float>(0, 1, 0);
+        t -= n * inner_prod(n, t);
+        len2 = t.norm2();
+      }
+      if(len2 > 0) t /= std::sqrt(len2);
+      const vector<3, float> nxt = vector3<float>(
+        n(1)*t(2) - n(2)*t(1),
+        n(2)*t(0) - n(0)*t(2),
+        n(0)*t(1) - n(1)*t(0));
+      vector<4, float> &out = tangents_[i];
+      out(0) = t(0);
+      out(1) = t(1);
+      out(2) = t(2);
+      out(3) = inner_prod(nxt, b) < 0 ? -1.0f : 1.0f;
+    }
+  }
+
+  const M &m_;
+  const std::vector<float> &sums_;
+  std::vector<vector<4, float> > &tangents_;
+  std::size_t nv_;
+};
+
+/**
+  \brief compute per-vertex tangents for normal mapping
+  Follows the MikkTSpace conventions: per-face tangent and bitangent
+  directions come from the uv gradients, are weighted by corner angle,
+  and the summed tangent is Gram-Schmidt orthogonalized against the
+  vertex normal.  The w component is the bitangent sign, so a shader
+  reconstructs the bitangent as w * cross(normal, tangent).  Unlike the
+  reference implementation, vertices are not split where handedness
+  changes; meshes are expected to already be split at uv seams.
+  \tparam M - supports mesh concept, with uvs and normals
+  \param m - mesh to compute tangents for
+  \param tangents - receives one (x, y, z, sign) tangent per vertex
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+ */
+template<typename M>
+void compute_tangents(const M &m, std::vector<vector<4, float> > &tangents,
+    unsigned threads = 0) {
+  const std::size_t nv = m.num_vertices();
+  const std::size_t nf = m.num_faces();
+  tangents.resize(nv);
+  if(nv == 0) return;
+  const std::size_t min_block = 1 << 15;
+
+  const std::size_t blocks = parallel_num_blocks(nf, min_block, threads);
+  std::vector<float> partials(6*nv*blocks, 0.0f);
+  mesh_accumulate_tangents_<M> accumulate(m, partials);
+  parallel_for_blocks(0, nf, accumulate, min_block, threads);
+  mesh_reduce_partials_ reduce(partials, 6*nv, blocks);
+  parallel_for_blocks(0, 6*nv, reduce, min_block, threads);
+  mesh_finish_tangents_<M> finish(m, partials, tangents);
+  parallel_for_blocks(0, nv, finish, min_block, threads);
+}
+
+}
+
+#endif
+
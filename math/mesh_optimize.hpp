@@ -0,0 +1,251 @@
+#ifndef _GHP_MATH_MESH_OPTIMIZE_HPP_
+#define _GHP_MATH_MESH_OPTIMIZE_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace ghp {
+
+/**
+  \brief average cache miss ratio of a mesh's index order
+  Simulates a FIFO post-transform vertex cache, as found in most GPUs,
+  and returns the number of vertex shader invocations per triangle.  1.0
+  is excellent, 3.0 means no reuse at all.
+  \tparam M - supports mesh concept
+  \param m - mesh to measure
+  \param cache_size - number of entries in the simulated cache
+ */
+template<typename M>
+float mesh_acmr(const M &m, int cache_size = 32) {
+  if(m.num_faces() == 0) return 0;
+  std::vector<int> timestamps(m.num_vertices(), -cache_size - 1);
+  int misses = 0;
+  for(int f=0; f<m.num_faces(); ++f) {
+    for(int v=0; v<3; ++v) {
+      const int i = m.faces(f)[v];
+      // a FIFO only admits on a miss, so an entry is live for exactly
+      // cache_size further misses
+      if(misses - timestamps[i] > cache_size) {
+        timestamps[i] = misses;
+        ++misses;
+      }
+    }
+  }
+  return static_cast<float>(misses) / m.num_faces();
+}
+
+/* vertex scoring from Forsyth's linear-speed vertex cache optimisation --
+  don't use this */
+struct vertex_cache_scores_ {
+  enum { cache_size = 32 };
+  enum { max_valence = 32 };
+
+  vertex_cache_scores_() {
+    for(int i=0; i<cache_size; ++i) {
+      if(i < 3) {
+        // the last triangle's vertices get a fixed score so that strips
+        // don't always win over fans
+        cache[i] = 0.75f;
+      } else {
+        const float scaler = 1.0f / (cache_size - 3);
+        cache[i] = std::pow(1.0f - (i - 3)*scaler, 1.5f);
+      }
+    }
+    valence[0] = 0;
+    for(int i=1; i<max_valence; ++i) {
+      valence[i] = 2.0f * std::pow(static_cast<float>(i), -0.5f);
+    }
+  }
+
+  inline float operator()(int cache_pos, int remaining) const {
+    if(remaining == 0) return -1;
+    float score = cache_pos >= 0 ? cache[cache_pos] : 0;
+    score += remaining < max_valence ? valence[remaining]
+      : 2.0f * std::pow(static_cast<float>(remaining), -0.5f);
+    return score;
+  }
+
+  float cache[cache_size];
+  float valence[max_valence];
+};
+
+/**
+  \brief reorder triangles for post-transform vertex cache reuse
+  Implements Tom Forsyth's "Linear-Speed Vertex Cache Optimisation":
+  triangles are emitted greedily by the summed score of their vertices,
+  where a vertex scores higher the more recently it entered a simulated
+  LRU cache and the fewer unemitted triangles still use it.  Only
+  triangles touching the cache are rescored, so the pass is linear in
+  the number of triangles.  Vertices are not touched.
+  \tparam M - supports mesh concept
+  \param m - mesh whose faces are reordered
+ */
+template<typename M>
+void optimize_vertex_cache(M &m) {
+  typedef typename M::face_t face_t;
+  enum { cache_size = vertex_cache_scores_::cache_size };
+  const int nv = m.num_vertices();
+  const int nf = m.num_faces();
+  if(nf == 0) return;
+  const vertex_cache_scores_ scoring;
+
+  // vertex -> triangle adjacency, packed
+  std::vector<int> offsets(nv + 1, 0);
+  for(int f=0; f<nf; ++f) {
+    for(int v=0; v<3; ++v) ++offsets[m.faces(f)[v] + 1];
+  }
+  for(int i=0; i<nv; ++i) offsets[i + 1] += offsets[i];
+  std::vector<int> remaining(nv);
+  for(int i=0; i<nv; ++i) remaining[i] = offsets[i + 1] - offsets[i];
+  std::vector<int> adjacency(offsets[nv]);
+  {
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for(int f=0; f<nf; ++f) {
+      for(int v=0; v<3; ++v) adjacency[fill[m.faces(f)[v]]++] = f;
+    }
+  }
+
+  std::vector<int> cache_pos(nv, -1);
+  std::vector<float> vertex_score(nv);
+  for(int i=0; i<nv; ++i) vertex_score[i] = scoring(-1, remaining[i]);
+  std::vector<float> face_score(nf);
+  for(int f=0; f<nf; ++f) {
+    face_score[f] = vertex_score[m.faces(f)[0]]
+      + vertex_score[m.faces(f)[1]] + vertex_score[m.faces(f)[2]];
+  }
+
+  std::vector<char> emitted(nf, 0);
+  std::vector<face_t> order;
+  order.reserve(nf);
+  int cache[cache_size + 3];
+  int cache_count = 0;
+  int best = 0;
+  for(int f=1; f<nf; ++f) {
+    if(face_score[f] > face_score[best]) best = f;
+  }
+  int cursor = 0;
+
+  while(static_cast<int>(order.size()) < nf) {
+    if(best < 0) {
+      // nothing in the cache is usable; restart at the next unemitted
+      // triangle, which keeps the overall scan linear
+      while(emitted[cursor]) ++cursor;
+      best = cursor;
+    }
+    const face_t face = m.faces(best);
+    emitted[best] = 1;
+    order.push_back(face);
+
+    // the triangle's vertices move to the front of the LRU cache
+    int new_cache[cache_size + 3];
+    int new_count = 0;
+    for(int v=0; v<3; ++v) {
+      // drop this triangle from the vertex's remaining list, once per
+      // corner, since a degenerate triangle is listed once per corner
+      const int i = face[v];
+      int *adj = &adjacency[offsets[i]];
+      int *adj_end = adj + remaining[i];
+      *std::find(adj, adj_end, best) = *(adj_end - 1);
+      --remaining[i];
+      if((v > 0 && i == face[0]) || (v > 1 && i == face[1])) continue;
+      new_cache[new_count++] = i;
+    }
+    for(int c=0; c<cache_count; ++c) {
+      const int i = cache[c];
+      if(i != face[0] && i != face[1] && i != face[2]) {
+        new_cache[new_count++] = i;
+      }
+    }
+
+    // rescore everything that was or is in the cache, and the triangles
+    // using those vertices; remember the best of them for the next step
+    best = -1;
+    float best_score = -1;
+    for(int c=0; c<new_count; ++c) {
+      const int i = new_cache[c];
+      cache_pos[i] = c < cache_size ? c : -1;
+      const float score = scoring(cache_pos[i], remaining[i]);
+      const float delta = score - vertex_score[i];
+      vertex_score[i] = score;
+      for(int a=offsets[i]; a<offsets[i] + remaining[i]; ++a) {
+        const int g = adjacency[a];
+        face_score[g] += delta;
+      }
+    }
+    for(int c=0; c<new_count; ++c) {
+      const int i = new_cache[c];
+      for(int a=offsets[i]; a<offsets[i] + remaining[i]; ++a) {
+        const int g = adjacency[a];
+        if(face_score[g] > best_score) {
+          best_score = face_score[g];
+          best = g;
+        }
+      }
+    }
+
+    cache_count = std::min<int>(new_count, cache_size);
+    std::copy(new_cache, new_cache + cache_count, cache);
+  }
+
+  for(int f=0; f<nf; ++f) m.faces(f) = order[f];
+}
+
+/**
+  \brief reorder vertices into the order the index buffer first uses them
+  Improves pre-transform (fetch) locality once triangles are in their
+  final order, e.g. after optimize_vertex_cache.  Vertices no face uses
+  are moved to the end.
+  \tparam M - supports mesh concept
+  \param m - mesh whose vertices are reordered
+ */
+template<typename M>
+void optimize_vertex_fetch(M &m) {
+  const int nv = m.num_vertices();
+  const int nf = m.num_faces();
+  std::vector<int> remap(nv, -1);
+  int next = 0;
+  for(int f=0; f<nf; ++f) {
+    for(int v=0; v<3; ++v) {
+      int &r = remap[m.faces(f)[v]];
+      if(r < 0) r = next++;
+      m.faces(f)[v] = r;
+    }
+  }
+  for(int i=0; i<nv; ++i) {
+    if(remap[i] < 0) remap[i] = next++;
+  }
+
+  std::vector<int> sources(nv);
+  for(int i=0; i<nv; ++i) sources[remap[i]] = i;
+  m.gather_vertices(sources);
+}
+
+/** \brief ACMR of a mesh before and after optimize_mesh */
+struct mesh_optimize_stats {
+  float acmr_before;
+  float acmr_after;
+};
+
+/**
+  \brief optimize a mesh's triangle and vertex order for rendering
+  Runs optimize_vertex_cache followed by optimize_vertex_fetch.
+  \tparam M - supports mesh concept
+  \param m - mesh to optimize
+  \param cache_size - FIFO size used to report ACMR
+  \returns ACMR of the mesh before and after
+ */
+template<typename M>
+mesh_optimize_stats optimize_mesh(M &m, int cache_size = 32) {
+  mesh_optimize_stats stats;
+  stats.acmr_before = mesh_acmr(m, cache_size);
+  optimize_vertex_cache(m);
+  optimize_vertex_fetch(m);
+  stats.acmr_after = mesh_acmr(m, cache_size);
+  return stats;
+}
+
+}
+
+#endif
+
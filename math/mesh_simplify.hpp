@@ -0,0 +1,465 @@
+#ifndef _GHP_MATH_MESH_SIMPLIFY_HPP_
+#define _GHP_MATH_MESH_SIMPLIFY_HPP_
+
+#include "vector.hpp"
+#include "vertex_aux.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+namespace ghp {
+
+/* symmetric 4x4 error quadric, upper triangle only -- don't use this */
+struct quadric_ {
+  quadric_() {
+    for(int i=0; i<10; ++i) q[i] = 0;
+  }
+  /* w * (plane)(plane)^T for the plane n.x + d = 0 */
+  quadric_(double nx, double ny, double nz, double d, double w) {
+    q[0] = w*nx*nx; q[1] = w*nx*ny; q[2] = w*nx*nz; q[3] = w*nx*d;
+    q[4] = w*ny*ny; q[5] = w*ny*nz; q[6] = w*ny*d;
+    q[7] = w*nz*nz; q[8] = w*nz*d;
+    q[9] = w*d*d;
+  }
+  inline quadric_& operator+=(const quadric_ &o) {
+    for(int i=0; i<10; ++i) q[i] += o.q[i];
+    return *this;
+  }
+  inline double operator()(const double *p) const {
+    const double x = p[0], y = p[1], z = p[2];
+    return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+      + q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+      + q[7]*z*z + 2*q[8]*z
+      + q[9];
+  }
+
+  double q[10];
+};
+
+/* a candidate half-edge collapse, from -> to -- don't use this */
+struct simplify_collapse_ {
+  double cost;
+  int from;
+  int to;
+  unsigned from_version;
+  unsigned to_version;
+};
+
+/* edge-collapse state for one simplification -- don't use this */
+class mesh_simplifier_ {
+public:
+  mesh_simplifier_(const std::vector<double> &positions,
+      const std::vector<int> &indices, const std::vector<char> &locked,
+      double boundary_weight)
+      : positions_(positions),
+      indices_(indices),
+      locked_(locked),
+      nv_(positions.size() / 3),
+      nf_(indices.size() / 3),
+      live_faces_(nf_),
+      quadrics_(nv_),
+      vertex_faces_(nv_),
+      version_(nv_, 0),
+      face_alive_(nf_, 1),
+      mark_(nv_, 0),
+      stamp_(0) {
+    for(int f=0; f<nf_; ++f) {
+      for(int v=0; v<3; ++v) vertex_faces_[indices_[3*f + v]].push_back(f);
+    }
+    build_quadrics_(boundary_weight);
+    for(int f=0; f<nf_; ++f) {
+      for(int v=0; v<3; ++v) {
+        const int a = indices_[3*f + v];
+        const int b = indices_[3*f + (v + 1) % 3];
+        if(a < b) push_edge_(a, b, false);
+      }
+    }
+    std::make_heap(heap_.begin(), heap_.end(), std::greater<uint64_t>());
+  }
+
+  /* collapse until at most target faces remain or the cheapest collapse
+    exceeds max_error */
+  void run(int target, double max_error) {
+    while(live_faces_ > target && !heap_.empty()) {
+      std::pop_heap(heap_.begin(), heap_.end(), std::greater<uint64_t>());
+      const uint32_t slot = static_cast<uint32_t>(heap_.back());
+      heap_.pop_back();
+      const simplify_collapse_ c = collapses_[slot];
+      free_.push_back(slot);
+      if(c.cost > max_error) break;
+      // lazy deletion: entries for vertices that changed since they were
+      // queued are stale
+      if(version_[c.from] != c.from_version
+          || version_[c.to] != c.to_version) {
+        continue;
+      }
+      if(!collapse_ok_(c.from, c.to)) continue;
+      collapse_(c.from, c.to);
+    }
+  }
+
+  inline int num_faces() const { return nf_; }
+  inline bool face_alive(int f) const { return face_alive_[f]; }
+  inline const std::vector<int>& indices() const { return indices_; }
+
+private:
+  inline const double* pos_(int v) const { return &positions_[3*v]; }
+
+  static inline void face_normal_(const double *p0, const double *p1,
+      const double *p2, double *n) {
+    const double e1[3] = { p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2] };
+    const double e2[3] = { p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2] };
+    n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+    n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+    n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+  }
+
+  void build_quadrics_(double boundary_weight) {
+    // one plane per face, weighted by area
+    for(int f=0; f<nf_; ++f) {
+      const int *face = &indices_[3*f];
+      double n[3];
+      face_normal_(pos_(face[0]), pos_(face[1]), pos_(face[2]), n);
+      const double len = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+      if(len == 0) continue;
+      for(int k=0; k<3; ++k) n[k] /= len;
+      const double *p = pos_(face[0]);
+      const quadric_ q(n[0], n[1], n[2],
+        -(n[0]*p[0] + n[1]*p[1] + n[2]*p[2]), 0.5*len);
+      for(int v=0; v<3; ++v) quadrics_[face[v]] += q;
+    }
+
+    // edges used by only one face are mesh boundaries or uv/normal
+    // seams; a heavily weighted plane through each, perpendicular to its
+    // face, keeps collapses from dragging them around.  An edge a -> b is
+    // shared if another of a's faces also uses b
+    for(int f=0; f<nf_; ++f) {
+      const int *face = &indices_[3*f];
+      for(int v=0; v<3; ++v) {
+        const int a = face[v];
+        const int b = face[(v + 1) % 3];
+        const std::vector<int> &around = vertex_faces_[a];
+        bool shared = false;
+        for(std::size_t i=0; i<around.size() && !shared; ++i) {
+          shared = around[i] != f && face_has_(around[i], b);
+        }
+        if(shared) continue;
+
+        double n[3];
+        face_normal_(pos_(face[0]), pos_(face[1]), pos_(face[2]), n);
+        const double *p0 = pos_(a);
+        const double *p1 = pos_(b);
+        const double e[3] = { p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2] };
+        double m[3] = {
+          e[1]*n[2] - e[2]*n[1],
+          e[2]*n[0] - e[0]*n[2],
+          e[0]*n[1] - e[1]*n[0]
+        };
+        const double len = std::sqrt(m[0]*m[0] + m[1]*m[1] + m[2]*m[2]);
+        if(len == 0) continue;
+        for(int k=0; k<3; ++k) m[k] /= len;
+        const double w = boundary_weight
+          * (e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
+        const quadric_ q(m[0], m[1], m[2],
+          -(m[0]*p0[0] + m[1]*p0[1] + m[2]*p0[2]), w);
+        quadrics_[a] += q;
+        quadrics_[b] += q;
+      }
+    }
+  }
+
+  /* queue the cheaper direction of collapsing edge (a, b); the heap
+    holds just the cost's float bits (ordered like the cost, as it is
+    never negative) above a slot in collapses_, which keeps it small and
+    its comparisons cheap */
+  void push_edge_(int a, int b, bool heapify = true) {
+    quadric_ q = quadrics_[a];
+    q += quadrics_[b];
+    simplify_collapse_ c;
+    c.cost = std::numeric_limits<double>::max();
+    if(!locked_[a]) {
+      c.cost = q(pos_(b));
+      c.from = a;
+      c.to = b;
+    }
+    if(!locked_[b]) {
+      const double cost = q(pos_(a));
+      if(cost < c.cost) {
+        c.cost = cost;
+        c.from = b;
+        c.to = a;
+      }
+    }
+    if(c.cost == std::numeric_limits<double>::max()) return;
+    c.cost = std::max(c.cost, 0.0);
+    c.from_version = version_[c.from];
+    c.to_version = version_[c.to];
+    uint32_t slot;
+    if(free_.empty()) {
+      slot = collapses_.size();
+      collapses_.push_back(c);
+    } else {
+      slot = free_.back();
+      free_.pop_back();
+      collapses_[slot] = c;
+    }
+    const float key = static_cast<float>(c.cost);
+    uint32_t key_bits;
+    std::memcpy(&key_bits, &key, sizeof(key_bits));
+    heap_.push_back(uint64_t(key_bits) << 32 | slot);
+    if(heapify) {
+      std::push_heap(heap_.begin(), heap_.end(), std::greater<uint64_t>());
+    }
+  }
+
+  /* drop dead faces from a vertex's face list */
+  void prune_(int v) {
+    std::vector<int> &faces = vertex_faces_[v];
+    std::size_t out = 0;
+    for(std::size_t i=0; i<faces.size(); ++i) {
+      if(face_alive_[faces[i]]) faces[out++] = faces[i];
+    }
+    faces.resize(out);
+  }
+
+  inline bool face_has_(int f, int v) const {
+    const int *face = &indices_[3*f];
+    return face[0] == v || face[1] == v || face[2] == v;
+  }
+
+  /* link condition (keeps the surface manifold) and no flipped faces */
+  bool collapse_ok_(int from, int to) {
+    prune_(from);
+    prune_(to);
+    ++stamp_;
+    const std::vector<int> &from_faces = vertex_faces_[from];
+    const std::vector<int> &to_faces = vertex_faces_[to];
+    int shared_faces = 0;
+    for(std::size_t i=0; i<from_faces.size(); ++i) {
+      const int *face = &indices_[3*from_faces[i]];
+      if(face_has_(from_faces[i], to)) ++shared_faces;
+      for(int v=0; v<3; ++v) mark_[face[v]] = stamp_;
+    }
+    if(shared_faces == 0) return false;
+    int shared_neighbours = 0;
+    ++stamp_;
+    for(std::size_t i=0; i<to_faces.size(); ++i) {
+      const int *face = &indices_[3*to_faces[i]];
+      for(int v=0; v<3; ++v) {
+        const int n = face[v];
+        if(n != from && n != to && mark_[n] == stamp_ - 1) {
+          ++shared_neighbours;
+          mark_[n] = stamp_; // count each neighbour once
+        }
+      }
+    }
+    if(shared_neighbours != shared_faces) return false;
+
+    for(std::size_t i=0; i<from_faces.size(); ++i) {
+      const int f = from_faces[i];
+      if(face_has_(f, to)) continue;
+      const int *face = &indices_[3*f];
+      const double *p[3];
+      double before[3], after[3];
+      for(int v=0; v<3; ++v) p[v] = pos_(face[v]);
+      face_normal_(p[0], p[1], p[2], before);
+      for(int v=0; v<3; ++v) {
+        if(face[v] == from) p[v] = pos_(to);
+      }
+      face_normal_(p[0], p[1], p[2], after);
+      const double dot = before[0]*after[0] + before[1]*after[1]
+        + before[2]*after[2];
+      if(dot <= 0) return false;
+    }
+    return true;
+  }
+
+  void collapse_(int from, int to) {
+    std::vector<int> &from_faces = vertex_faces_[from];
+    std::vector<int> &to_faces = vertex_faces_[to];
+    for(std::size_t i=0; i<from_faces.size(); ++i) {
+      const int f = from_faces[i];
+      if(face_has_(f, to)) {
+        face_alive_[f] = 0;
+        --live_faces_;
+      } else {
+        int *face = &indices_[3*f];
+        for(int v=0; v<3; ++v) {
+          if(face[v] == from) face[v] = to;
+        }
+        to_faces.push_back(f);
+      }
+    }
+    std::vector<int>().swap(from_faces);
+    quadrics_[to] += quadrics_[from];
+    ++version_[from];
+    prune_(to);
+
+    // everything touching the merged vertex has new costs
+    ++version_[to];
+    ++stamp_;
+    for(std::size_t i=0; i<to_faces.size(); ++i) {
+      const int *face = &indices_[3*to_faces[i]];
+      for(int v=0; v<3; ++v) {
+        const int n = face[v];
+        if(n != to && mark_[n] != stamp_) {
+          mark_[n] = stamp_;
+          push_edge_(to, n);
+        }
+      }
+    }
+  }
+
+  const std::vector<double> &positions_;
+  std::vector<int> indices_;
+  const std::vector<char> &locked_;
+  int nv_;
+  int nf_;
+  int live_faces_;
+  std::vector<quadric_> quadrics_;
+  std::vector<std::vector<int> > vertex_faces_;
+  std::vector<unsigned> version_;
+  std::vector<char> face_alive_;
+  std::vector<unsigned> mark_;
+  unsigned stamp_;
+  std::vector<uint64_t> heap_;
+  std::vector<simplify_collapse_> collapses_;
+  std::vector<uint32_t> free_;
+};
+
+/* orders vertex indices by location -- don't use this */
+struct simplify_position_less_ {
+  simplify_position_less_(const std::vector<double> &p) : p_(&p) { }
+  inline bool operator()(int a, int b) const {
+    const double *pa = &(*p_)[3*a];
+    const double *pb = &(*p_)[3*b];
+    return std::lexicographical_compare(pa, pa + 3, pb, pb + 3);
+  }
+  const std::vector<double> *p_;
+};
+
+/**
+  \brief simplify a mesh by quadric-error edge collapse
+  Implements Garland and Heckbert's quadric error metric with half-edge
+  collapses: each vertex merges into a neighbour, keeping that
+  neighbour's position, normal and uv, so no attributes are
+  interpolated.  Candidate collapses sit in a priority queue and are
+  invalidated lazily through per-vertex version counters.
+
+  Vertices that share a location with another vertex (i.e. lie on a uv
+  or normal seam) are never moved, and edges used by a single face
+  carry a penalty plane, so seams and open borders are preserved.
+  Collapses that would make the surface non-manifold or flip a face are
+  skipped.
+
+  Collapses run one at a time on a single thread; expect roughly half a
+  million faces removed per second on a closed mesh, not millions.
+  \tparam M - supports mesh concept
+  \param in - mesh to simplify
+  \param out - simplified mesh; unused vertices are removed
+  \param target_faces - stop once this many faces remain
+  \param max_error - stop once the cheapest collapse costs more than this
+    (squared distance, summed over the merged planes)
+  \param boundary_weight - weight of the seam/border penalty planes
+ */
+template<typename M>
+void simplify_mesh(const M &in, M &out, int target_faces,
+    double max_error = std::numeric_limits<double>::max(),
+    double boundary_weight = 1000) {
+  typedef typename M::const_vertex_access_t access_t;
+  const int nv = in.num_vertices();
+  const int nf = in.num_faces();
+
+  std::vector<double> positions(3*nv);
+  for(int i=0; i<nv; ++i) {
+    vector<3, float> p;
+    vertex_read_loc<access_t>()(in.vertices(i), p);
+    for(int k=0; k<3; ++k) positions[3*i + k] = p(k);
+  }
+  std::vector<int> indices(3*nf);
+  for(int f=0; f<nf; ++f) {
+    for(int v=0; v<3; ++v) indices[3*f + v] = in.faces(f)[v];
+  }
+
+  // vertices sharing an exact location are seam vertices: lock them
+  std::vector<char> locked(nv, 0);
+  {
+    std::vector<int> order(nv);
+    for(int i=0; i<nv; ++i) order[i] = i;
+    std::sort(order.begin(), order.end(),
+      simplify_position_less_(positions));
+    for(int i=1; i<nv; ++i) {
+      if(std::equal(&positions[3*order[i]], &positions[3*order[i]] + 3,
+          &positions[3*order[i - 1]])) {
+        locked[order[i]] = locked[order[i - 1]] = 1;
+      }
+    }
+  }
+
+  mesh_simplifier_ simplifier(positions, indices, locked, boundary_weight);
+  simplifier.run(target_faces, max_error);
+
+  const std::vector<int> &result = simplifier.indices();
+  std::vector<int> remap(nv, -1);
+  int out_vertices = 0;
+  int out_faces = 0;
+  for(int f=0; f<nf; ++f) {
+    if(!simplifier.face_alive(f)) continue;
+    ++out_faces;
+    for(int v=0; v<3; ++v) {
+      int &r = remap[result[3*f + v]];
+      if(r < 0) r = out_vertices++;
+    }
+  }
+  out.resize_vertices(out_vertices);
+  for(int i=0; i<nv; ++i) {
+    if(remap[i] >= 0) out.vertices(remap[i]) = in.vertices(i);
+  }
+  out.resize_faces(out_faces);
+  for(int f=0, o=0; f<nf; ++f) {
+    if(!simplifier.face_alive(f)) continue;
+    for(int v=0; v<3; ++v) out.faces(o)[v] = remap[result[3*f + v]];
+    ++o;
+  }
+}
+
+/**
+  \brief build a chain of successively simpler levels of detail
+  Level 0 is a copy of the input; each further level is simplified from
+  the previous one down to ratio times its face count.  The chain stops
+  early if a level can no longer be reduced.
+  \tparam M - supports mesh concept
+  \param in - full detail mesh
+  \param lods - receives the levels of detail, finest first
+  \param levels - maximum number of levels, including level 0
+  \param ratio - face count of each level relative to the previous one
+  \param max_error - per-level error bound passed to simplify_mesh
+ */
+template<typename M>
+void build_lod_chain(const M &in, std::vector<M> &lods, int levels,
+    float ratio = 0.5f,
+    double max_error = std::numeric_limits<double>::max()) {
+  lods.clear();
+  if(levels <= 0) return;
+  lods.reserve(levels);
+  lods.push_back(in);
+  for(int l=1; l<levels; ++l) {
+    const M &prev = lods.back();
+    const int target = static_cast<int>(prev.num_faces() * ratio);
+    M next;
+    simplify_mesh(prev, next, target, max_error);
+    if(next.num_faces() >= prev.num_faces()) break;
+    lods.push_back(next);
+  }
+}
+
+}
+
+#endif
+
@@ -0,0 +1,263 @@
+#ifndef _GHP_MATH_MESH_STORAGE_HPP_
+#define _GHP_MATH_MESH_STORAGE_HPP_
+
+#include "vertex.hpp"
+#include "vertex_aux.hpp"
+
+#include <vector>
+
+namespace ghp {
+
+/*
+  Vertex storage policies for mesh.  A policy is a class template over
+  the vertex backend V providing:
+
+    vertex_t        - the value type, vertex<V>
+    access_t        - type to instantiate the vertex_read_* and
+                      vertex_write_* adapters with for mutable access
+    const_access_t  - the same, for read-only access
+    reference, const_reference - what element access returns
+    size(), resize(n), at(i), gather(sources)
+ */
+
+/** \brief stores each vertex as one interleaved vertex<V> record
+  \tparam V - has vertex concept
+ */
+template<typename V>
+class interleaved_storage {
+public:
+  typedef vertex<V> vertex_t;
+  typedef vertex_t access_t;
+  typedef vertex_t const_access_t;
+  typedef vertex_t& reference;
+  typedef const vertex_t& const_reference;
+
+  /** \brief number of vertices */
+  inline std::size_t size() const { return vertices_.size(); }
+  /** \brief change the number of vertices */
+  inline void resize(std::size_t n) { vertices_.resize(n); }
+  /** \brief element access */
+  inline reference at(std::size_t i) { return vertices_[i]; }
+  /** \brief element access */
+  inline const_reference at(std::size_t i) const { return vertices_[i]; }
+  /** \brief replace the contents with vertices[sources[i]] */
+  void gather(const std::vector<int> &sources) {
+    std::vector<vertex_t> gathered(sources.size());
+    for(std::size_t i=0; i<sources.size(); ++i) {
+      gathered[i] = vertices_[sources[i]];
+    }
+    vertices_.swap(gathered);
+  }
+
+  /** \brief the vertex records, contiguous */
+  inline vertex_t* data() { return vertices_.empty() ? NULL : &vertices_[0]; }
+  /** \brief the vertex records, contiguous */
+  inline const vertex_t* data() const {
+    return vertices_.empty() ? NULL : &vertices_[0];
+  }
+
+private:
+  std::vector<vertex_t> vertices_;
+};
+
+/** \brief handle to one vertex of a stream_storage
+  Behaves like a vertex<V> with location(), normal() and uv() members,
+  but refers to elements of separate attribute streams.  Assigning to a
+  handle copies attribute values; it never rebinds the handle.
+  \tparam V - has vertex concept
+  \tparam VEC - V::vector_t, or const V::vector_t for read-only handles
+  \tparam UV - V::uv_t, or const V::uv_t for read-only handles
+ */
+template<typename V, typename VEC = typename V::vector_t,
+    typename UV = typename V::uv_t>
+class stream_vertex_ref {
+public:
+  typedef typename V::vector_t vector_t;
+  typedef typename V::uv_t uv_t;
+
+  stream_vertex_ref(VEC *loc, VEC *norm, UV *uv)
+      : loc_(loc), norm_(norm), uv_(uv) { }
+  /** \brief mutable handles convert to read-only ones */
+  template<typename VEC2, typename UV2>
+  stream_vertex_ref(const stream_vertex_ref<V, VEC2, UV2> &r)
+      : loc_(&r.location()), norm_(&r.normal()), uv_(&r.uv()) { }
+
+  /** \brief element access */
+  inline VEC& location() const { return *loc_; }
+  /** \brief element access */
+  inline VEC& normal() const { return *norm_; }
+  /** \brief element access */
+  inline UV& uv() const { return *uv_; }
+
+  /** \brief copy attribute values from a vertex */
+  const stream_vertex_ref& operator=(const vertex<V> &v) const {
+    *loc_ = v.location();
+    *norm_ = v.normal();
+    vertex_read_uv<V>()(v, *uv_);
+    return *this;
+  }
+  /** \brief copy attribute values from another vertex handle */
+  const stream_vertex_ref& operator=(const stream_vertex_ref &r) const {
+    *loc_ = r.location();
+    *norm_ = r.normal();
+    *uv_ = r.uv();
+    return *this;
+  }
+  /** \brief copy attribute values from another vertex handle */
+  template<typename VEC2, typename UV2>
+  const stream_vertex_ref& operator=(
+      const stream_vertex_ref<V, VEC2, UV2> &r) const {
+    *loc_ = r.location();
+    *norm_ = r.normal();
+    *uv_ = r.uv();
+    return *this;
+  }
+
+  /** \brief copy the referenced attributes out into a vertex */
+  operator vertex<V>() const {
+    vertex<V> v;
+    v.location() = *loc_;
+    v.normal() = *norm_;
+    vertex_write_uv<V>()(v, *uv_);
+    return v;
+  }
+
+private:
+  VEC *loc_;
+  VEC *norm_;
+  UV *uv_;
+};
+
+//
+// adapters/template magic for stream_vertex_ref.  writers take the handle
+// by value so temporaries returned from mesh::vertices() can be written.
+template<typename V, typename VEC, typename UV>
+struct vertex_write_loc<stream_vertex_ref<V, VEC, UV> > {
+  template<typename S>
+  inline void operator()(stream_vertex_ref<V, VEC, UV> v, const S &s) {
+    v.location() = s;
+  }
+};
+template<typename V, typename VEC, typename UV>
+struct vertex_read_loc<stream_vertex_ref<V, VEC, UV> > {
+  template<typename S>
+  inline void operator()(const stream_vertex_ref<V, VEC, UV> &v, S &s) {
+    s = v.location();
+  }
+};
+
+template<typename V, typename VEC, typename UV>
+struct vertex_write_norm<stream_vertex_ref<V, VEC, UV> > {
+  template<typename S>
+  inline void operator()(stream_vertex_ref<V, VEC, UV> v, const S &s) {
+    v.normal() = s;
+  }
+};
+template<typename V, typename VEC, typename UV>
+struct vertex_read_norm<stream_vertex_ref<V, VEC, UV> > {
+  template<typename S>
+  inline void operator()(const stream_vertex_ref<V, VEC, UV> &v, S &s) {
+    s = v.normal();
+  }
+};
+
+// only backends with real texture coordinates expose the uv stream
+template<int N, typename T, typename VEC, typename UV>
+struct vertex_write_uv<stream_vertex_ref<lnu_vertex<N, T>, VEC, UV> > {
+  template<typename S>
+  inline void operator()(stream_vertex_ref<lnu_vertex<N, T>, VEC, UV> v,
+      const S &s) {
+    v.uv() = s;
+  }
+};
+template<int N, typename T, typename VEC, typename UV>
+struct vertex_read_uv<stream_vertex_ref<lnu_vertex<N, T>, VEC, UV> > {
+  template<typename S>
+  inline void operator()(
+      const stream_vertex_ref<lnu_vertex<N, T>, VEC, UV> &v, S &s) {
+    s = v.uv();
+  }
+};
+
+/** \brief stores locations, normals and uvs in separate streams
+  Passes that only touch one attribute (bounds, culling, skinning) then
+  stream through just that attribute, and each stream can be handed to
+  SIMD kernels or uploaded to the GPU as-is.  Element access returns
+  stream_vertex_ref handles.
+  \tparam V - has vertex concept, with location() and normal() members
+ */
+template<typename V>
+class stream_storage {
+public:
+  typedef vertex<V> vertex_t;
+  typedef typename V::vector_t vector_t;
+  typedef typename V::uv_t uv_t;
+  typedef stream_vertex_ref<V> access_t;
+  typedef stream_vertex_ref<V, const vector_t, const uv_t> const_access_t;
+  typedef access_t reference;
+  typedef const_access_t const_reference;
+
+  /** \brief number of vertices */
+  inline std::size_t size() const { return locations_.size(); }
+  /** \brief change the number of vertices */
+  void resize(std::size_t n) {
+    locations_.resize(n);
+    normals_.resize(n);
+    uvs_.resize(n);
+  }
+  /** \brief element access */
+  inline reference at(std::size_t i) {
+    return reference(&locations_[i], &normals_[i], &uvs_[i]);
+  }
+  /** \brief element access */
+  inline const_reference at(std::size_t i) const {
+    return const_reference(&locations_[i], &normals_[i], &uvs_[i]);
+  }
+  /** \brief replace the contents with vertices[sources[i]] */
+  void gather(const std::vector<int> &sources) {
+    gather_(locations_, sources);
+    gather_(normals_, sources);
+    gather_(uvs_, sources);
+  }
+
+  /** \brief location stream, contiguous */
+  inline vector_t* locations() { return data_(locations_); }
+  /** \brief location stream, contiguous */
+  inline const vector_t* locations() const { return data_(locations_); }
+  /** \brief normal stream, contiguous */
+  inline vector_t* normals() { return data_(normals_); }
+  /** \brief normal stream, contiguous */
+  inline const vector_t* normals() const { return data_(normals_); }
+  /** \brief uv stream, contiguous */
+  inline uv_t* uvs() { return data_(uvs_); }
+  /** \brief uv stream, contiguous */
+  inline const uv_t* uvs() const { return data_(uvs_); }
+
+private:
+  template<typename T>
+  static void gather_(std::vector<T> &stream,
+      const std::vector<int> &sources) {
+    std::vector<T> gathered(sources.size());
+    for(std::size_t i=0; i<sources.size(); ++i) {
+      gathered[i] = stream[sources[i]];
+    }
+    stream.swap(gathered);
+  }
+  template<typename T>
+  static inline T* data_(std::vector<T> &v) {
+    return v.empty() ? NULL : &v[0];
+  }
+  template<typename T>
+  static inline const T* data_(const std::vector<T> &v) {
+    return v.empty() ? NULL : &v[0];
+  }
+
+  std::vector<vector_t> locations_;
+  std::vector<vector_t> normals_;
+  std::vector<uv_t> uvs_;
+};
+
+}
+
+#endif
+
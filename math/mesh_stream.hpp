@@ -0,0 +1,621 @@
+#ifndef _GHP_MATH_MESH_STREAM_HPP_
+#define _GHP_MATH_MESH_STREAM_HPP_
+
+#include "mesh_binary.hpp"
+#include "mesh_util.hpp"
+#include "obj_parser.hpp"
+#include "../util/mapped_file.hpp"
+#include "../util/parallel.hpp"
+
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+namespace ghp {
+
+/*
+  Out-of-core conversion of OBJ files to the binary mesh format.  Nothing
+  proportional to the whole mesh is held in memory; instead data moves
+  through temporary spill files next to the output:
+
+    1. the OBJ file is mapped and parsed a budget-sized chunk at a time;
+       locations, normals, uvs and triangle corners are appended to spill
+       files, with relative indices resolved against running totals.
+    2. corners are hash-partitioned on their (v, vt, vn) triple into
+       enough partitions that each one fits in the budget.
+    3. each partition is welded on its own: unique triples become output
+       vertices, whose (v, vt, vn) indices are appended to request
+       spills, and each corner's vertex index is stored with the
+       partition.
+    4. each vertex stream is gathered from its requests without random
+       reads: requests are bucketed by source range, each range is loaded
+       and resolved, and the results are bucketed by vertex range and
+       written out in order.
+    5. the binary mesh is written by copying the vertex streams, then
+       replaying the corners in order; each corner's index is the next
+       id of the partition it hashed to, so no random writes are needed.
+
+  Spills are written and read sequentially through buffers of bounded
+  size, never mapped, so only the mapped OBJ input is left to the page
+  cache.  Bucketed spills (partitions, requests, results) keep all their
+  buckets in one file, so the number of open files stays constant.
+ */
+
+/* seek a spill file to a byte offset -- don't use this */
+inline bool mesh_spill_seek_(std::FILE *file, uint64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+  return fseeko(file, offset, SEEK_SET) == 0;
+#endif
+}
+
+/* buffered reader of fixed-size records from a spill file -- don't use
+  this */
+class mesh_spill_reader_ : public boost::noncopyable {
+public:
+  mesh_spill_reader_(const std::string &path, std::size_t buffer_size)
+      : file_(std::fopen(path.c_str(), "rb")),
+      path_(path) {
+    if(file_ == NULL) {
+      throw std::runtime_error("couldn't open file " + path);
+    }
+    std::setvbuf(file_, NULL, _IOFBF, buffer_size);
+  }
+  ~mesh_spill_reader_() {
+    std::fclose(file_);
+  }
+
+  template<typename T>
+  void read(T *t, std::size_t n) {
+    if(n != 0 && std::fread(t, sizeof(T), n, file_) != n) {
+      throw std::runtime_error("couldn't read file " + path_);
+    }
+  }
+private:
+  std::FILE *file_;
+  std::string path_;
+};
+
+/* fixed-size records grouped into buckets, laid out back to back in one
+  spill file: fill them with add() or write(), then flush() and read them
+  back with read() or next().  Each bucket has a small buffer of its own,
+  so adding and reading in order stay sequential per bucket -- don't use
+  this */
+class mesh_spill_buckets_ : public boost::noncopyable {
+public:
+  mesh_spill_buckets_(const std::string &path,
+      const std::vector<uint64_t> &counts, std::size_t record_size,
+      std::size_t buffer_size)
+      : file_(std::fopen(path.c_str(), "w+b")),
+      path_(path),
+      record_size_(record_size),
+      per_buffer_(std::max<std::size_t>(buffer_size / record_size, 1)),
+      begins_(counts.size() + 1, 0),
+      cursors_(counts.size()),
+      buffers_(counts.size()),
+      positions_(counts.size(), 0) {
+    if(file_ == NULL) {
+      throw std::runtime_error("couldn't open file for writing " + path);
+    }
+    // every buffer is ours, so stdio's would only copy again
+    std::setvbuf(file_, NULL, _IONBF, 0);
+    for(std::size_t b=0; b<counts.size(); ++b) {
+      begins_[b + 1] = begins_[b] + counts[b];
+      cursors_[b] = begins_[b];
+    }
+  }
+  ~mesh_spill_buckets_() {
+    std::fclose(file_);
+  }
+
+  inline uint64_t size(std::size_t b) const {
+    return begins_[b + 1] - begins_[b];
+  }
+
+  /* append one record to bucket b */
+  void add(std::size_t b, const void *record) {
+    std::vector<char> &buffer = buffers_[b];
+    const char *r = static_cast<const char*>(record);
+    buffer.insert(buffer.end(), r, r + record_size_);
+    if(buffer.size() >= per_buffer_*record_size_) flush_(b);
+  }
+  /* append n records to bucket b, unbuffered */
+  void write(std::size_t b, const void *records, uint64_t n) {
+    flush_(b);
+    write_at_(cursors_[b], records, n);
+    cursors_[b] += n;
+  }
+  /* finish adding; afterwards, reading starts at each bucket's front */
+  void flush() {
+    for(std::size_t b=0; b<buffers_.size(); ++b) {
+      flush_(b);
+      cursors_[b] = begins_[b];
+    }
+  }
+  /* read all of bucket b */
+  void read(std::size_t b, void *records) {
+    read_at_(begins_[b], records, size(b));
+  }
+  /* read the next record of bucket b */
+  void next(std::size_t b, void *record) {
+    std::vector<char> &buffer = buffers_[b];
+    if(positions_[b] == buffer.size()) {
+      const uint64_t n = std::min<uint64_t>(per_buffer_,
+        begins_[b + 1] - cursors_[b]);
+      if(n == 0) throw std::runtime_error("couldn't read file " + path_);
+      buffer.resize(n*record_size_);
+      read_at_(cursors_[b], &buffer[0], n);
+      cursors_[b] += n;
+      positions_[b] = 0;
+    }
+    std::memcpy(record, &buffer[positions_[b]], record_size_);
+    positions_[b] += record_size_;
+  }
+
+private:
+  void flush_(std::size_t b) {
+    std::vector<char> &buffer = buffers_[b];
+    if(buffer.empty()) return;
+    const uint64_t n = buffer.size() / record_size_;
+    write_at_(cursors_[b], &buffer[0], n);
+    cursors_[b] += n;
+    buffer.clear();
+  }
+  void write_at_(uint64_t record, const void *data, uint64_t n) {
+    if(n == 0) return;
+    if(!mesh_spill_seek_(file_, record*record_size_)
+        || std::fwrite(data, record_size_, n, file_) != n) {
+      throw std::runtime_error("couldn't write file " + path_);
+    }
+  }
+  void read_at_(uint64_t record, void *data, uint64_t n) {
+    if(n == 0) return;
+    if(!mesh_spill_seek_(file_, record*record_size_)
+        || std::fread(data, record_size_, n, file_) != n) {
+      throw std::runtime_error("couldn't read file " + path_);
+    }
+  }
+
+  std::FILE *file_;
+  std::string path_;
+  std::size_t record_size_;
+  std::size_t per_buffer_;
+  std::vector<uint64_t> begins_;
+  std::vector<uint64_t> cursors_;
+  std::vector<std::vector<char> > buffers_;
+  std::vector<std::size_t> positions_;
+};
+
+/* names spill files and removes them when done -- don't use this */
+class mesh_spill_files_ : public boost::noncopyable {
+public:
+  mesh_spill_files_(const std::string &prefix)
+      : prefix_(prefix) { }
+  ~mesh_spill_files_() {
+    for(std::size_t i=0; i<paths_.size(); ++i) {
+      std::remove(paths_[i].c_str());
+    }
+  }
+
+  /* path of a new spill file, removed on destruction */
+  std::string path(const std::string &name) {
+    paths_.push_back(prefix_ + ".spill." + name);
+    return paths_.back();
+  }
+
+private:
+  std::string prefix_;
+  std::vector<std::string> paths_;
+};
+
+/* pass 1: parse the OBJ text into spill files -- don't use this */
+inline void obj_stream_parse_(const char *begin, const char *end,
+    std::size_t chunk_size, unsigned threads,
+    mesh_binary_writer_ &locs, mesh_binary_writer_ &norms,
+    mesh_binary_writer_ &uvs, mesh_binary_writer_ &corners,
+    uint64_t totals[4]) {
+  const std::size_t min_chunk = 1 << 20;
+  totals[0] = totals[1] = totals[2] = totals[3] = 0;
+  const char *p = begin;
+  while(p != end) {
+    const char *e = static_cast<std::size_t>(end - p) > chunk_size
+      ? obj_line_start_(p, p + chunk_size, end) : end;
+    const std::size_t size = e - p;
+
+    std::vector<obj_chunk_> chunks(
+      parallel_num_blocks(size, min_chunk, threads));
+    obj_parse_chunks_ parse(p, e, chunks);
+    parallel_for_blocks(0, size, parse, min_chunk, threads);
+
+    for(std::size_t c=0; c<chunks.size(); ++c) {
+      obj_data &d = chunks[c].data;
+      // shift indices that were relative to this piece by everything
+      // parsed before it, and reject references to later data
+      if(!d.corners.empty()) {
+        const int64_t shift[3] = {
+          static_cast<int64_t>(totals[0]), static_cast<int64_t>(totals[2]),
+          static_cast<int64_t>(totals[1])
+        };
+        obj_shift_chunk_(chunks[c], &d.corners[0], shift);
+      }
+      if(!d.locs.empty()) {
+        locs.write_bytes(&d.locs[0], d.locs.size()*sizeof(d.locs[0]), false);
+      }
+      if(!d.norms.empty()) {
+        norms.write_bytes(&d.norms[0], d.norms.size()*sizeof(d.norms[0]),
+          false);
+      }
+      if(!d.uvs.empty()) {
+        uvs.write_bytes(&d.uvs[0], d.uvs.size()*sizeof(d.uvs[0]), false);
+      }
+      if(!d.corners.empty()) {
+        corners.write_bytes(&d.corners[0],
+          d.corners.size()*sizeof(d.corners[0]), false);
+      }
+      totals[0] += d.locs.size();
+      totals[1] += d.norms.size();
+      totals[2] += d.uvs.size();
+      totals[3] += d.corners.size();
+      chunks[c] = obj_chunk_();
+    }
+    p = e;
+  }
+}
+
+/* partition a corner hashes to -- don't use this function */
+inline std::size_t obj_stream_partition_(const obj_corner &c,
+    std::size_t num_partitions) {
+  // the high bits pick the partition, the low bits the slot within it
+  return (obj_corner_hash_(c) >> 32) % num_partitions;
+}
+
+/* buffer size for each of a spill's buckets -- don't use this */
+inline std::size_t obj_stream_buffer_size_(std::size_t memory_budget,
+    std::size_t num_buckets) {
+  return std::max<std::size_t>(std::min<std::size_t>(
+    memory_budget / 8 / std::max<std::size_t>(num_buckets, 1), 1 << 20),
+    4096);
+}
+
+/* a vertex and the source record it wants -- don't use this */
+struct obj_stream_request_ {
+  uint32_t vertex;
+  uint32_t source;
+};
+
+/* a vertex and its gathered values -- don't use this */
+struct obj_stream_value_ {
+  uint32_t vertex;
+  float values[3];
+};
+
+/* pass 4: write the width floats of source record requests[k], or zeros
+  for an optional -1, for every vertex k, reading and writing only
+  sequentially -- don't use this */
+inline void obj_stream_gather_(const std::string &requests_path,
+    uint64_t num_vertices, const std::string &source_path,
+    uint64_t num_sources, int width, bool optional,
+    const std::string &out_path, std::size_t memory_budget,
+    mesh_spill_files_ &spill, const std::string &name) {
+  // a range of source records, or of vertices, takes a quarter of the
+  // budget when loaded
+  const uint64_t range = std::max<uint64_t>(
+    memory_budget / 4 / (width*sizeof(float)), 1);
+  const std::size_t num_source_ranges = (num_sources + range - 1) / range;
+  const std::size_t num_vertex_ranges = (num_vertices + range - 1) / range;
+  const std::size_t buffer_size = obj_stream_buffer_size_(memory_budget,
+    2*std::max(num_source_ranges, num_vertex_ranges));
+  const std::size_t block = 1 << 14;
+  std::vector<int32_t> requests(block);
+
+  std::vector<uint64_t> source_counts(num_source_ranges, 0);
+  std::vector<uint64_t> vertex_counts(num_vertex_ranges, 0);
+  {
+    mesh_spill_reader_ in(requests_path, buffer_size);
+    for(uint64_t b=0; b<num_vertices; b+=block) {
+      const std::size_t n = std::min<uint64_t>(block, num_vertices - b);
+      in.read(&requests[0], n);
+      for(std::size_t i=0; i<n; ++i) {
+        const int32_t r = requests[i];
+        if(r < -1 || (r == -1 && !optional)
+            || (r >= 0 && static_cast<uint64_t>(r) >= num_sources)) {
+          throw std::runtime_error("couldn't understand OBJ file (bad index)");
+        }
+        if(r < 0) continue;
+        ++source_counts[r / range];
+        ++vertex_counts[(b + i) / range];
+      }
+    }
+  }
+
+  mesh_spill_buckets_ wanted(spill.path(name + "_requests"),
+    source_counts, sizeof(obj_stream_request_), buffer_size);
+  {
+    mesh_spill_reader_ in(requests_path, buffer_size);
+    for(uint64_t b=0; b<num_vertices; b+=block) {
+      const std::size_t n = std::min<uint64_t>(block, num_vertices - b);
+      in.read(&requests[0], n);
+      for(std::size_t i=0; i<n; ++i) {
+        if(requests[i] < 0) continue;
+        const obj_stream_request_ q = {
+          static_cast<uint32_t>(b + i), static_cast<uint32_t>(requests[i])
+        };
+        wanted.add(q.source / range, &q);
+      }
+    }
+  }
+  wanted.flush();
+
+  mesh_spill_buckets_ found(spill.path(name + "_values"),
+    vertex_counts, sizeof(obj_stream_value_), buffer_size);
+  std::vector<float> values;
+  {
+    mesh_spill_reader_ source(source_path, buffer_size);
+    for(std::size_t s=0; s<num_source_ranges; ++s) {
+      const uint64_t first = s*range;
+      const std::size_t n = std::min<uint64_t>(range, num_sources - first);
+      values.resize(width*n);
+      source.read(&values[0], width*n);
+      for(uint64_t k=0; k<wanted.size(s); ++k) {
+        obj_stream_request_ q;
+        wanted.next(s, &q);
+        obj_stream_value_ v = { q.vertex, { 0, 0, 0 } };
+        std::memcpy(v.values, &values[width*(q.source - first)],
+          width*sizeof(float));
+        found.add(v.vertex / range, &v);
+      }
+    }
+  }
+  found.flush();
+
+  mesh_binary_writer_ out(out_path, buffer_size);
+  for(std::size_t d=0; d<num_vertex_ranges; ++d) {
+    const uint64_t first = d*range;
+    const std::size_t n = std::min<uint64_t>(range, num_vertices - first);
+    values.assign(width*n, 0.0f);
+    for(uint64_t k=0; k<found.size(d); ++k) {
+      obj_stream_value_ v;
+      found.next(d, &v);
+      std::memcpy(&values[width*(v.vertex - first)], v.values,
+        width*sizeof(float));
+    }
+    out.write_bytes(&values[0], width*n*sizeof(float), false);
+  }
+  out.close();
+}
+
+/**
+  \brief convert an OBJ file to a binary mesh without loading it
+  For assets too large to hold in memory: the file is streamed through
+  temporary spill files (see above) and corners are welded on their
+  (v, vt, vn) indices, as load_obj_mesh does, one hash partition at a
+  time.  Heap use stays around memory_budget regardless of the mesh
+  size, and spills are only read and written sequentially; the mapped
+  input is left to the page cache.  Vertices come out grouped by
+  partition, so their order differs from load_obj_mesh's.  The output
+  records the OBJ file's size and modification time, so it is accepted
+  as a load_obj_mesh_cached cache.
+  \param obj_path - path of OBJ file
+  \param out_path - path of binary mesh to write; spill files are created
+    next to it
+  \param memory_budget - approximate bound on heap use, in bytes
+  \param threads - maximum number of parsing threads; 0 uses
+    hardware_threads()
+  \throws std::runtime_error if the OBJ file can't be read or parsed, if
+    it has more than 2^32 vertices, or if a file can't be written
+ */
+inline void convert_obj_to_binary(const std::string &obj_path,
+    const std::string &out_path, std::size_t memory_budget = 256 << 20,
+    unsigned threads = 0) {
+  memory_budget = std::max<std::size_t>(memory_budget, 16 << 20);
+  mesh_spill_files_ spill(out_path);
+  const std::string locs_path = spill.path("locs");
+  const std::string norms_path = spill.path("norms");
+  const std::string uvs_path = spill.path("uvs");
+  const std::string corners_path = spill.path("corners");
+
+  uint64_t source_size;
+  int64_t source_mtime;
+  if(!mesh_binary_stat_(obj_path, source_size, source_mtime)) {
+    throw std::runtime_error("couldn't open file " + obj_path);
+  }
+
+  // 1. parse; a chunk's obj_data is about as large as its text
+  uint64_t totals[4];
+  {
+    mapped_file file(obj_path);
+    mesh_binary_writer_ locs(locs_path), norms(norms_path), uvs(uvs_path),
+      corners(corners_path);
+    obj_stream_parse_(file.data(), file.end(), memory_budget / 4, threads,
+      locs, norms, uvs, corners, totals);
+    locs.close();
+    norms.close();
+    uvs.close();
+    corners.close();
+  }
+  const uint64_t num_corners = totals[3];
+
+  // 2. partition so that welding one partition (keys, table and ids,
+  // about 40 bytes a corner) fits in half the budget
+  const uint64_t per_partition = std::max<uint64_t>(
+    memory_budget / 2 / 40, 1);
+  const std::size_t num_partitions =
+    (num_corners + per_partition - 1) / per_partition + 1;
+  const std::size_t buffer_size = obj_stream_buffer_size_(memory_budget,
+    num_partitions);
+  const std::size_t block = 3*4096;
+  std::vector<obj_corner> corner_block(block);
+  std::vector<uint64_t> counts(num_partitions, 0);
+  {
+    mesh_spill_reader_ corners(corners_path, buffer_size);
+    for(uint64_t b=0; b<num_corners; b+=block) {
+      const std::size_t n = std::min<uint64_t>(block, num_corners - b);
+      corners.read(&corner_block[0], n);
+      for(std::size_t i=0; i<n; ++i) {
+        ++counts[obj_stream_partition_(corner_block[i], num_partitions)];
+      }
+    }
+  }
+  mesh_spill_buckets_ keys(spill.path("keys"), counts, sizeof(obj_corner),
+    buffer_size);
+  {
+    mesh_spill_reader_ corners(corners_path, buffer_size);
+    for(uint64_t b=0; b<num_corners; b+=block) {
+      const std::size_t n = std::min<uint64_t>(block, num_corners - b);
+      corners.read(&corner_block[0], n);
+      for(std::size_t i=0; i<n; ++i) {
+        keys.add(obj_stream_partition_(corner_block[i], num_partitions),
+          &corner_block[i]);
+      }
+    }
+  }
+  keys.flush();
+
+  // 3. weld each partition, emitting vertex requests and per-corner ids
+  const std::string loc_requests_path = spill.path("loc_requests");
+  const std::string norm_requests_path = spill.path("norm_requests");
+  const std::string uv_requests_path = spill.path("uv_requests");
+  mesh_spill_buckets_ ids(spill.path("ids"), counts, sizeof(uint32_t),
+    buffer_size);
+  uint64_t num_vertices = 0;
+  {
+    mesh_binary_writer_ loc_requests(loc_requests_path),
+      norm_requests(norm_requests_path), uv_requests(uv_requests_path);
+    std::vector<obj_corner> c;
+    std::vector<int32_t> table;
+    std::vector<uint32_t> firsts;
+    std::vector<uint32_t> partition_ids;
+    for(std::size_t p=0; p<num_partitions; ++p) {
+      const std::size_t n = counts[p];
+      c.resize(n);
+      if(n > 0) keys.read(p, &c[0]);
+      std::size_t capacity = 16;
+      while(capacity < 2*n) capacity <<= 1;
+      const std::size_t mask = capacity - 1;
+      table.assign(capacity, -1);
+      firsts.clear();
+      partition_ids.resize(n);
+      for(std::size_t i=0; i<n; ++i) {
+        std::size_t slot = obj_corner_hash_(c[i]) & mask;
+        for(;;) {
+          const int32_t j = table[slot];
+          if(j < 0) {
+            table[slot] = firsts.size();
+            partition_ids[i] = num_vertices + firsts.size();
+            firsts.push_back(i);
+            break;
+          }
+          const obj_corner &o = c[firsts[j]];
+          if(o.v == c[i].v && o.vt == c[i].vt && o.vn == c[i].vn) {
+            partition_ids[i] = num_vertices + j;
+            break;
+          }
+          slot = (slot + 1) & mask;
+        }
+      }
+
+      for(std::size_t k=0; k<firsts.size(); ++k) {
+        const obj_corner &o = c[firsts[k]];
+        loc_requests.write_bytes(&o.v, sizeof(int32_t), false);
+        norm_requests.write_bytes(&o.vn, sizeof(int32_t), false);
+        uv_requests.write_bytes(&o.vt, sizeof(int32_t), false);
+      }
+      num_vertices += firsts.size();
+      if(num_vertices > 0xffffffffULL) {
+        throw std::runtime_error("OBJ file has too many vertices "
+          + obj_path);
+      }
+      if(n > 0) ids.write(p, &partition_ids[0], n);
+    }
+    loc_requests.close();
+    norm_requests.close();
+    uv_requests.close();
+  }
+  ids.flush();
+
+  // 4. gather the vertex streams
+  const std::string out_locs_path = spill.path("out_locs");
+  const std::string out_norms_path = spill.path("out_norms");
+  const std::string out_uvs_path = spill.path("out_uvs");
+  obj_stream_gather_(loc_requests_path, num_vertices, locs_path, totals[0],
+    3, false, out_locs_path, memory_budget, spill, "locs");
+  obj_stream_gather_(norm_requests_path, num_vertices, norms_path,
+    totals[1], 3, true, out_norms_path, memory_budget, spill, "norms");
+  obj_stream_gather_(uv_requests_path, num_vertices, uvs_path, totals[2],
+    2, true, out_uvs_path, memory_budget, spill, "uvs");
+
+  // 5. assemble the binary mesh
+  mesh_binary_header header = mesh_binary_init_header_(num_vertices,
+    num_corners / 3, source_size, source_mtime);
+  const std::string tmp = out_path + ".tmp";
+  try {
+    mesh_binary_writer_ out(tmp);
+    out.write_bytes(&header, sizeof(header), false);
+    const std::string *streams[] = {
+      &out_locs_path, &out_norms_path, &out_uvs_path
+    };
+    uint64_t *offsets[] = {
+      &header.locs_offset, &header.norms_offset, &header.uvs_offset
+    };
+    const std::size_t vertex_block = 4096;
+    std::vector<float> values(3*vertex_block);
+    for(int s=0; s<3; ++s) {
+      const int width = s == 2 ? 2 : 3;
+      mesh_spill_reader_ in(*streams[s], buffer_size);
+      out.align(64);
+      *offsets[s] = out.offset();
+      for(uint64_t b=0; b<num_vertices; b+=vertex_block) {
+        const std::size_t n = std::min<uint64_t>(vertex_block,
+          num_vertices - b);
+        in.read(&values[0], width*n);
+        if(s == 0) {
+          for(std::size_t i=0; i<n; ++i) {
+            for(int k=0; k<3; ++k) {
+              header.bounds_min[k] = std::min(header.bounds_min[k],
+                values[3*i + k]);
+              header.bounds_max[k] = std::max(header.bounds_max[k],
+                values[3*i + k]);
+            }
+          }
+        }
+        out.write(&values[0], width*n);
+      }
+    }
+    out.align(64);
+    header.indices_offset = out.offset();
+    {
+      mesh_spill_reader_ corners(corners_path, buffer_size);
+      std::vector<uint32_t> indices(block);
+      for(uint64_t b=0; b<num_corners; b+=block) {
+        const std::size_t n = std::min<uint64_t>(block, num_corners - b);
+        corners.read(&corner_block[0], n);
+        for(std::size_t i=0; i<n; ++i) {
+          ids.next(obj_stream_partition_(corner_block[i], num_partitions),
+            &indices[i]);
+        }
+        out.write(&indices[0], n);
+      }
+    }
+    mesh_binary_finish_(out, header);
+  } catch(...) {
+    std::remove(tmp.c_str());
+    throw;
+  }
+  std::remove(out_path.c_str());
+  if(std::rename(tmp.c_str(), out_path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    throw std::runtime_error("couldn't write file " + out_path);
+  }
+}
+
+}
+
+#endif
@@ -1,109 +1,138 @@
 #ifndef _GHP_MATH_MESH_UTIL_HPP_
 #define _GHP_MATH_MESH_UTIL_HPP_
 
+#include "obj_parser.hpp"
 #include "vector.hpp"
 #include "vertex_aux.hpp"
+#include "../util/mapped_file.hpp"
+#include "../util/parallel.hpp"
 
-#include <boost/algorithm/string.hpp>
-#include <boost/array.hpp>
-
-#include <iostream>
-#include <fstream>
-#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
-#include <cstdio>
+#include <stdint.h>
 
 namespace ghp {
 
-/** 
-  \brief load a wavefront OBJ mesh
-  \tparam M - supports mesh concept
-  \param path - path of file to load
-  \param m - mesh in which to store result 
- */
+/* hash of a corner's index triple -- don't use this function */
+inline uint64_t obj_corner_hash_(const obj_corner &c) {
+  uint64_t h = static_cast<uint32_t>(c.v) * 0x9E3779B97F4A7C15ULL;
+  h ^= static_cast<uint32_t>(c.vt) * 0xC2B2AE3D27D4EB4FULL;
+  h ^= static_cast<uint32_t>(c.vn) * 0x165667B19E3779F9ULL;
+  return h ^ (h >> 29);
+}
+
+/* fills mesh vertices from OBJ corners -- don't use this */
 template<typename M>
-void load_obj_mesh(const std::string &path, M &m) {
-  typedef typename M::vertex_t vertex_t;
-
-  // collection datatypes
-  std::vector<vector<3, float> > locs;
-  std::vector<vector<3, float> > norms;
-  std::vector<vector<2, float> > uvs;
-  std::vector<boost::array<boost::array<int, 3>, 3> > faces;
-
-  std::stringstream ss;
-  std::ifstream in(path.c_str());
-  while(!in.eof()) {
-    // get and clean a line
-    std::string line;
-    std::getline(in, line);
-    boost::to_lower(line);
-    boost::trim(line);
-    ss.clear();
-    ss.str(line);
-
-    // determine the line type and read data
-    std::string line_type;
-    ss >> line_type;
-    if(line_type == "v") { // location
-      vector<3, float> v;
-      ss >> v(0) >> v(1) >> v(2);
-      locs.push_back(v);
-    } else if(line_type == "vn") { // normal
-      vector<3, float> v;
-      ss >> v(0) >> v(1) >> v(2);
-      norms.push_back(v);
-    } else if(line_type == "vt") { // uv coordinates
-      vector<2, float> v;
-      ss >> v(0) >> v(1);
-      uvs.push_back(v);
-    } else if(line_type == "f") { // face
-      boost::array<boost::array<int, 3>, 3> face;
+struct obj_write_vertices_ {
+  typedef typename M::vertex_access_t access_t;
+
+  obj_write_vertices_(const obj_data &d,
+      const std::vector<int32_t> &vertex_corner, M &m)
+    : d_(d), vertex_corner_(vertex_corner), m_(m) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    const vector<3, float> zero3;
+    const vector<2, float> zero2;
+    for(std::size_t i=begin; i<end; ++i) {
+      const obj_corner &c = d_.corners[vertex_corner_[i]];
+      vertex_write_loc<access_t>()(m_.vertices(i), d_.locs[c.v]);
+      vertex_write_norm<access_t>()(m_.vertices(i),
+        c.vn >= 0 ? d_.norms[c.vn] : zero3);
+      vertex_write_uv<access_t>()(m_.vertices(i),
+        c.vt >= 0 ? d_.uvs[c.vt] : zero2);
+    }
+  }
+
+  const obj_data &d_;
+  const std::vector<int32_t> &vertex_corner_;
+  M &m_;
+};
+
+/* fills mesh faces from per-corner vertex indices -- don't use this */
+template<typename M>
+struct obj_write_faces_ {
+  obj_write_faces_(const std::vector<int32_t> &corner_vertex, M &m)
+    : corner_vertex_(corner_vertex), m_(m) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    for(std::size_t f=begin; f<end; ++f) {
       for(int v=0; v<3; ++v) {
-        std::string v_str;
-        boost::array<int, 3> this_v;
-        ss >> v_str;
-        // LOC/UV/NORM
-        if(sscanf(v_str.c_str(), "%d/%d/%d", 
-            &this_v[0], &this_v[1], &this_v[2]) == 3) {
-          face[v] = this_v;
-        } else if(sscanf(v_str.c_str(), "%d/%d//",
-            &this_v[0], &this_v[1]) == 2) {
-          face[v] = this_v;
-        } else if(sscanf(v_str.c_str(), "%d//%d",
-            &this_v[0], &this_v[2]) == 2) {
-          face[v] = this_v;
-        } else if(sscanf(v_str.c_str(), "%d/%d",
-            &this_v[0], &this_v[2]) == 2) {
-          face[v] = this_v;
-        } else {
-          throw std::runtime_error(
-            "couldn't understand OBJ file (must be triangularized!)");
-        }
+        m_.faces(f)[v] = corner_vertex_[3*f + v];
       }
-      faces.push_back(face);
     }
   }
 
-  // inefficiently form the mesh
-  m.resize_faces(faces.size());
-  m.resize_vertices(3 * faces.size());
-  for(int face=0; face<faces.size(); ++face) {
-    for(int v=0; v<3; ++v) {
-      vertex_write_loc<vertex_t>()(m.vertices(3*face+v),
-        locs[faces[face][v][0] - 1]);
-      vertex_write_norm<vertex_t>()(m.vertices(3*face+v),
-       norms[faces[face][v][2] - 1]);
-      vertex_write_uv<vertex_t>()(m.vertices(3*face+v),
-        uvs[faces[face][v][1] - 1]);
+  const std::vector<int32_t> &corner_vertex_;
+  M &m_;
+};
+
+/**
+  \brief form a mesh from parsed OBJ data
+  Each distinct (location, uv, normal) index triple becomes one vertex,
+  so the result is already welded as far as the file's indices allow.
+  \tparam M - supports mesh concept
+  \param d - parsed OBJ contents
+  \param m - mesh in which to store result
+ */
+template<typename M>
+void build_obj_mesh(const obj_data &d, M &m) {
+  const std::size_t num_corners = d.corners.size();
+
+  // open-addressing table from index triple to vertex
+  std::size_t capacity = 16;
+  while(capacity < 2*num_corners) capacity <<= 1;
+  const std::size_t mask = capacity - 1;
+  std::vector<int32_t> table(capacity, -1);
+  std::vector<int32_t> corner_vertex(num_corners);
+  std::vector<int32_t> vertex_corner;
+  vertex_corner.reserve(num_corners / 2);
+  for(std::size_t i=0; i<num_corners; ++i) {
+    const obj_corner &c = d.corners[i];
+    std::size_t slot = obj_corner_hash_(c) & mask;
+    for(;;) {
+      const int32_t j = table[slot];
+      if(j < 0) {
+        table[slot] = vertex_corner.size();
+        corner_vertex[i] = vertex_corner.size();
+        vertex_corner.push_back(i);
+        break;
+      }
+      const obj_corner &o = d.corners[vertex_corner[j]];
+      if(o.v == c.v && o.vt == c.vt && o.vn == c.vn) {
+        corner_vertex[i] = j;
+        break;
+      }
+      slot = (slot + 1) & mask;
     }
   }
 
-  // clean up aforementioned inefficiencies
-  m.compact();
+  m.resize_vertices(vertex_corner.size());
+  obj_write_vertices_<M> write_vertices(d, vertex_corner, m);
+  parallel_for_blocks(0, vertex_corner.size(), write_vertices, 1 << 16);
+  m.resize_faces(num_corners / 3);
+  obj_write_faces_<M> write_faces(corner_vertex, m);
+  parallel_for_blocks(0, num_corners / 3, write_faces, 1 << 16);
+}
+
+/** 
+  \brief load a wavefront OBJ mesh
+  The file is memory mapped and parsed in line-aligned chunks on
+  several threads (see parse_obj_parallel); polygons are
+  fan-triangulated and relative indices are supported.
+  \tparam M - supports mesh concept
+  \param path - path of file to load
+  \param m - mesh in which to store result 
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+  \throws std::runtime_error if the file can't be read or parsed
+ */
+template<typename M>
+void load_obj_mesh(const std::string &path, M &m, unsigned threads = 0) {
+  mapped_file file(path);
+  obj_data d;
+  parse_obj_parallel(file.data(), file.end(), d, threads);
+  build_obj_mesh(d, m);
 }
 
 }
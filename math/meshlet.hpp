@@ -0,0 +1,262 @@
+#ifndef _GHP_MATH_MESHLET_HPP_
+#define _GHP_MATH_MESHLET_HPP_
+
+#include "vector.hpp"
+#include "vertex_aux.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+#include <cmath>
+
+namespace ghp {
+
+/** \brief one cluster of a mesh, with culling data
+  Vertices are meshlet_data::vertices[vertex_offset ... + vertex_count),
+  triangles are triangle_count triples of local (8-bit) indices into
+  those, starting at meshlet_data::triangles[triangle_offset].
+ */
+struct meshlet {
+  int vertex_offset;
+  int vertex_count;
+  int triangle_offset;
+  int triangle_count;
+
+  /** bounding sphere */
+  vector<3, float> center;
+  float radius;
+
+  /** normal cone: the cluster faces away from any eye for which
+    dot(normalize(cone_apex - eye), cone_axis) >= cone_cutoff.  A cutoff
+    above 1 means the cluster can't be backface culled. */
+  vector<3, float> cone_apex;
+  vector<3, float> cone_axis;
+  float cone_cutoff;
+};
+
+/** \brief the clusters of a mesh, as produced by build_meshlets */
+struct meshlet_data {
+  std::vector<meshlet> meshlets;
+  /** mesh vertex indices, referenced by meshlet::vertex_offset */
+  std::vector<int> vertices;
+  /** local vertex indices, referenced by meshlet::triangle_offset */
+  std::vector<unsigned char> triangles;
+};
+
+/**
+  \brief test whether a whole cluster faces away from the eye
+  \param c - meshlet to test
+  \param eye - camera position, in the mesh's space
+ */
+inline bool meshlet_backfacing(const meshlet &c, const vector<3, float> &eye) {
+  if(c.cone_cutoff > 1) return false;
+  vector<3, float> d = c.cone_apex - eye;
+  const float len2 = d.norm2();
+  if(len2 == 0) return false;
+  return inner_prod(d, c.cone_axis) >= c.cone_cutoff * std::sqrt(len2);
+}
+
+/* fills a meshlet's bounding sphere and normal cone -- don't use this */
+template<typename M>
+void meshlet_bounds_(const M &m, const meshlet_data &d, meshlet &c) {
+  typedef typename M::const_vertex_access_t access_t;
+  const int *verts = &d.vertices[c.vertex_offset];
+  const unsigned char *tris = &d.triangles[c.triangle_offset];
+
+  std::vector<vector<3, float> > p(c.vertex_count);
+  for(int i=0; i<c.vertex_count; ++i) {
+    vertex_read_loc<access_t>()(m.vertices(verts[i]), p[i]);
+  }
+
+  // Ritter's sphere: start from an approximately farthest pair, then
+  // grow to cover any point left outside
+  int a = 0, b = 0;
+  for(int i=1; i<c.vertex_count; ++i) {
+    if((p[i] - p[0]).norm2() > (p[a] - p[0]).norm2()) a = i;
+  }
+  for(int i=1; i<c.vertex_count; ++i) {
+    if((p[i] - p[a]).norm2() > (p[b] - p[a]).norm2()) b = i;
+  }
+  vector<3, float> center = (p[a] + p[b]) * 0.5f;
+  float radius = std::sqrt((p[b] - p[a]).norm2()) * 0.5f;
+  for(int i=0; i<c.vertex_count; ++i) {
+    const float dist = std::sqrt((p[i] - center).norm2());
+    if(dist > radius) {
+      const float grown = (radius + dist) * 0.5f;
+      center += (p[i] - center) * ((grown - radius) / dist);
+      radius = grown;
+    }
+  }
+  c.center = center;
+  c.radius = radius;
+
+  // the cone axis is the average face normal; the cutoff follows from
+  // the normal that deviates from it the most
+  std::vector<vector<3, float> > normals;
+  normals.reserve(c.triangle_count);
+  vector<3, float> axis;
+  for(int t=0; t<c.triangle_count; ++t) {
+    const vector<3, float> &p0 = p[tris[3*t]];
+    const vector<3, float> e1 = p[tris[3*t + 1]] - p0;
+    const vector<3, float> e2 = p[tris[3*t + 2]] - p0;
+    vector<3, float> n = vector3<float>(
+      e1(1)*e2(2) - e1(2)*e2(1),
+      e1(2)*e2(0) - e1(0)*e2(2),
+      e1(0)*e2(1) - e1(1)*e2(0));
+    const float len2 = n.norm2();
+    if(len2 == 0) {
+      normals.push_back(n);
+      continue;
+    }
+    n /= std::sqrt(len2);
+    normals.push_back(n);
+    axis += n;
+  }
+  c.cone_apex = center;
+  c.cone_axis = vector3<float>(0, 0, 1);
+  c.cone_cutoff = 2;
+  const float axis_len2 = axis.norm2();
+  if(axis_len2 == 0) return;
+  axis /= std::sqrt(axis_len2);
+
+  float min_dot = 1;
+  for(int t=0; t<c.triangle_count; ++t) {
+    if(normals[t].norm2() == 0) continue;
+    const float dp = inner_prod(normals[t], axis);
+    if(dp < min_dot) min_dot = dp;
+  }
+  // a spread of 90 degrees or more has no eye position it's culled for
+  if(min_dot <= 0.1f) return;
+
+  // move the apex back along the axis until every triangle's plane is in
+  // front of it, so the cone test is conservative for the whole cluster
+  float max_t = 0;
+  for(int t=0; t<c.triangle_count; ++t) {
+    if(normals[t].norm2() == 0) continue;
+    const float dc = inner_prod(center - p[tris[3*t]], normals[t]);
+    const float dn = inner_prod(axis, normals[t]);
+    const float tt = dc / dn;
+    if(tt > max_t) max_t = tt;
+  }
+  c.cone_apex = center - axis * max_t;
+  c.cone_axis = axis;
+  c.cone_cutoff = std::sqrt(1 - min_dot*min_dot);
+}
+
+/**
+  \brief split a mesh into small clusters for culling and streaming
+  Triangles are grown greedily into a cluster from the triangles
+  adjacent to its vertices, taking the one that adds the fewest new
+  vertices (lowest index on ties) until the vertex or triangle limit is
+  reached; a new cluster starts at the first unassigned triangle in
+  index order.  Work per triangle is bounded by the cluster size, so
+  the pass is linear in the mesh size and fully deterministic.  Running
+  optimize_vertex_cache first gives tighter clusters.
+  \tparam M - supports mesh concept
+  \param m - mesh to partition
+  \param d - receives the clusters
+  \param max_vertices - vertex limit per cluster, at most 256
+  \param max_triangles - triangle limit per cluster
+ */
+template<typename M>
+void build_meshlets(const M &m, meshlet_data &d, int max_vertices = 64,
+    int max_triangles = 124) {
+  if(max_vertices < 3 || max_vertices > 256 || max_triangles < 1) {
+    throw std::runtime_error("build_meshlets: bad cluster limits");
+  }
+  const int nv = m.num_vertices();
+  const int nf = m.num_faces();
+  d.meshlets.clear();
+  d.vertices.clear();
+  d.triangles.clear();
+  if(nf == 0) return;
+
+  // vertex -> triangle adjacency, packed
+  std::vector<int> offsets(nv + 1, 0);
+  for(int f=0; f<nf; ++f) {
+    for(int v=0; v<3; ++v) ++offsets[m.faces(f)[v] + 1];
+  }
+  for(int i=0; i<nv; ++i) offsets[i + 1] += offsets[i];
+  std::vector<int> adjacency(offsets[nv]);
+  {
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for(int f=0; f<nf; ++f) {
+      for(int v=0; v<3; ++v) adjacency[fill[m.faces(f)[v]]++] = f;
+    }
+  }
+
+  std::vector<char> emitted(nf, 0);
+  std::vector<int> local(nv, -1);
+  std::vector<int> candidates;
+  int cursor = 0;
+  int assigned = 0;
+  meshlet c = meshlet();
+
+  while(assigned < nf) {
+    // choose the next triangle for the current cluster
+    int best = -1;
+    int best_cost = 4;
+    for(std::size_t k=0; k<candidates.size(); ) {
+      const int f = candidates[k];
+      if(emitted[f]) {
+        candidates[k] = candidates.back();
+        candidates.pop_back();
+        continue;
+      }
+      int cost = 0;
+      for(int v=0; v<3; ++v) {
+        const int i = m.faces(f)[v];
+        if(local[i] < 0 && (v == 0 || i != m.faces(f)[0])
+            && (v < 2 || i != m.faces(f)[1])) {
+          ++cost;
+        }
+      }
+      if(c.vertex_count + cost <= max_vertices
+          && (cost < best_cost || (cost == best_cost && f < best))) {
+        best = f;
+        best_cost = cost;
+      }
+      ++k;
+    }
+
+    if(best < 0 && c.triangle_count > 0) {
+      // nothing adjacent fits: close the cluster
+      meshlet_bounds_(m, d, c);
+      d.meshlets.push_back(c);
+      for(int i=0; i<c.vertex_count; ++i) {
+        local[d.vertices[c.vertex_offset + i]] = -1;
+      }
+      c = meshlet();
+      c.vertex_offset = d.vertices.size();
+      c.triangle_offset = d.triangles.size();
+      candidates.clear();
+      continue;
+    }
+    if(best < 0) {
+      while(emitted[cursor]) ++cursor;
+      best = cursor;
+    }
+
+    emitted[best] = 1;
+    ++assigned;
+    for(int v=0; v<3; ++v) {
+      const int i = m.faces(best)[v];
+      if(local[i] < 0) {
+        local[i] = c.vertex_count++;
+        d.vertices.push_back(i);
+        for(int a=offsets[i]; a<offsets[i + 1]; ++a) {
+          if(!emitted[adjacency[a]]) candidates.push_back(adjacency[a]);
+        }
+      }
+      d.triangles.push_back(static_cast<unsigned char>(local[i]));
+    }
+    if(++c.triangle_count == max_triangles) candidates.clear();
+  }
+  meshlet_bounds_(m, d, c);
+  d.meshlets.push_back(c);
+}
+
+}
+
+#endif
+
@@ -0,0 +1,484 @@
+#ifndef _GHP_MATH_OBJ_PARSER_HPP_
+#define _GHP_MATH_OBJ_PARSER_HPP_
+
+#include "vector.hpp"
+#include "../util/parallel.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+namespace ghp {
+
+/*
+  A single-pass tokenizer for wavefront OBJ text.  It works on a raw
+  [begin, end) byte range (usually a mapped_file) and never copies lines;
+  only v, vn, vt and f records are understood, everything else is skipped.
+ */
+
+/** \brief one corner of an OBJ face; 0-based indices, -1 if absent */
+struct obj_corner {
+  int32_t v;
+  int32_t vt;
+  int32_t vn;
+};
+
+/** \brief raw contents of an OBJ file, faces fan-triangulated */
+struct obj_data {
+  std::vector<vector<3, float> > locs;
+  std::vector<vector<3, float> > norms;
+  std::vector<vector<2, float> > uvs;
+  /** three corners per triangle */
+  std::vector<obj_corner> corners;
+};
+
+/* don't use these functions */
+inline bool obj_is_space_(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+inline bool obj_is_digit_(char c) {
+  return static_cast<unsigned>(c - '0') < 10;
+}
+inline const char* obj_skip_space_(const char *p, const char *end) {
+  while(p != end && obj_is_space_(*p)) ++p;
+  return p;
+}
+inline const char* obj_skip_line_(const char *p, const char *end) {
+  const void *nl = std::memchr(p, '\n', end - p);
+  return nl == NULL ? end : static_cast<const char*>(nl) + 1;
+}
+
+/* exact powers of ten representable as doubles */
+inline double obj_pow10_(int e) {
+  static const double table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  return e <= 22 ? table[e] : std::pow(10.0, e);
+}
+
+/**
+  \brief parse a decimal floating point number
+  Accumulates up to 19 significant digits in an integer and scales once
+  by a power of ten, which is correctly rounded for float output in all
+  but pathological cases.  Anything unusual (inf, nan, hex floats) falls
+  back to strtod.
+  \param p - first character; leading blanks are skipped
+  \param end - end of input
+  \param out - parsed value
+  \returns one past the last character consumed
+  \throws std::runtime_error if no number is present
+ */
+inline const char* obj_parse_float(const char *p, const char *end,
+    float &out) {
+  p = obj_skip_space_(p, end);
+  const char *start = p;
+  bool negative = false;
+  if(p != end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    ++p;
+  }
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any_digits = false;
+  for(; p != end && obj_is_digit_(*p); ++p) {
+    any_digits = true;
+    if(digits < 19) {
+      mantissa = mantissa*10 + (*p - '0');
+      if(mantissa != 0) ++digits;
+    } else {
+      ++exponent;
+    }
+  }
+  if(p != end && *p == '.') {
+    ++p;
+    for(; p != end && obj_is_digit_(*p); ++p) {
+      any_digits = true;
+      if(digits < 19) {
+        mantissa = mantissa*10 + (*p - '0');
+        if(mantissa != 0) ++digits;
+        --exponent;
+      }
+    }
+  }
+  if(!any_digits) {
+    // inf, nan and friends: hand a bounded copy to the C library
+    char buffer[64];
+    std::size_t len = 0;
+    while(start + len != end && len + 1 < sizeof(buffer)
+        && !obj_is_space_(start[len]) && start[len] != '\n') {
+      buffer[len] = start[len];
+      ++len;
+    }
+    buffer[len] = '\0';
+    char *parse_end;
+    const double d = std::strtod(buffer, &parse_end);
+    if(parse_end == buffer) {
+      throw std::runtime_error("couldn't understand OBJ file (bad number)");
+    }
+    out = static_cast<float>(d);
+    return start + (parse_end - buffer);
+  }
+  if(p != end && (*p == 'e' || *p == 'E')) {
+    const char *e = p + 1;
+    bool exp_negative = false;
+    if(e != end && (*e == '-' || *e == '+')) {
+      exp_negative = (*e == '-');
+      ++e;
+    }
+    if(e != end && obj_is_digit_(*e)) {
+      int exp_value = 0;
+      for(; e != end && obj_is_digit_(*e); ++e) {
+        if(exp_value < 10000) exp_value = exp_value*10 + (*e - '0');
+      }
+      exponent += exp_negative ? -exp_value : exp_value;
+      p = e;
+    }
+  }
+  double value = static_cast<double>(mantissa);
+  if(exponent < 0) {
+    if(exponent < -308) {
+      value = value / obj_pow10_(-exponent - 308) / 1e308;
+    } else {
+      value /= obj_pow10_(-exponent);
+    }
+  } else if(exponent > 0) {
+    value *= obj_pow10_(exponent);
+  }
+  out = static_cast<float>(negative ? -value : value);
+  return p;
+}
+
+/* parse a signed integer -- don't use this function */
+inline const char* obj_parse_int_(const char *p, const char *end,
+    int64_t &out, bool &ok) {
+  bool negative = false;
+  if(p != end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    ++p;
+  }
+  ok = (p != end && obj_is_digit_(*p));
+  int64_t value = 0;
+  for(; p != end && obj_is_digit_(*p); ++p) {
+    if(value < (int64_t(1) << 40)) value = value*10 + (*p - '0');
+  }
+  out = negative ? -value : value;
+  return p;
+}
+
+/* one line-aligned piece of a file being parsed in parallel -- don't use
+  this.  attributes are numbered 0 (v), 1 (vt) and 2 (vn) */
+struct obj_chunk_ {
+  obj_chunk_() {
+    min_offset[0] = min_offset[1] = min_offset[2] = 0;
+  }
+
+  obj_data data;
+  /* 3*corner + attribute for every chunk-relative index */
+  std::vector<std::size_t> fixups;
+  /* how many of each attribute must precede the chunk for its absolute
+    indices to refer only to data already seen, as parse_obj requires */
+  int64_t min_offset[3];
+};
+
+/* narrow a resolved index, which may still need shifting, to an
+  obj_corner index -- don't use this function */
+inline int32_t obj_narrow_index_(int64_t index) {
+  const int64_t limit = std::numeric_limits<int32_t>::max();
+  if(index < -limit || index > limit) {
+    throw std::runtime_error("couldn't understand OBJ file (bad index)");
+  }
+  return static_cast<int32_t>(index);
+}
+
+/* resolve a 1-based or negative (relative) OBJ index -- don't use this
+  function.  when parsing a chunk of a larger file (chunk != NULL),
+  positive indices are absolute and can't be range checked yet, so the
+  chunk records how much data must come before it; negative ones are
+  resolved against the chunk and may point before it, so the caller
+  records them to be shifted once the chunk's position in the file is
+  known. */
+inline int32_t obj_resolve_index_(int64_t index, std::size_t count,
+    int attribute, obj_chunk_ *chunk) {
+  const int64_t resolved = index > 0 ? index - 1
+    : static_cast<int64_t>(count) + index;
+  if(chunk != NULL && index != 0) {
+    if(index > 0) {
+      int64_t &min_offset = chunk->min_offset[attribute];
+      min_offset = std::max(min_offset,
+        index - static_cast<int64_t>(count));
+    }
+    return obj_narrow_index_(resolved);
+  }
+  if(index == 0 || resolved < 0 || resolved >= static_cast<int64_t>(count)) {
+    throw std::runtime_error("couldn't understand OBJ file (bad index)");
+  }
+  return obj_narrow_index_(resolved);
+}
+
+/* parse one face corner: v, v/vt, v//vn or v/vt/vn -- don't use this
+  function.  bit i of relative is set if attribute i was a relative
+  index into a chunk (see above) */
+inline const char* obj_parse_corner_(const char *p, const char *end,
+    const obj_data &d, obj_corner &c, unsigned &relative,
+    obj_chunk_ *chunk) {
+  int64_t index;
+  bool ok;
+  relative = 0;
+  p = obj_parse_int_(p, end, index, ok);
+  if(!ok) {
+    throw std::runtime_error("couldn't understand OBJ file (bad face)");
+  }
+  c.v = obj_resolve_index_(index, d.locs.size(), 0, chunk);
+  if(index < 0) relative |= 1;
+  c.vt = c.vn = -1;
+  if(p != end && *p == '/') {
+    ++p;
+    if(p != end && *p != '/') {
+      p = obj_parse_int_(p, end, index, ok);
+      if(!ok) {
+        throw std::runtime_error("couldn't understand OBJ file (bad face)");
+      }
+      c.vt = obj_resolve_index_(index, d.uvs.size(), 1, chunk);
+      if(index < 0) relative |= 2;
+    }
+    if(p != end && *p == '/') {
+      ++p;
+      p = obj_parse_int_(p, end, index, ok);
+      if(!ok) {
+        throw std::runtime_error("couldn't understand OBJ file (bad face)");
+      }
+      c.vn = obj_resolve_index_(index, d.norms.size(), 2, chunk);
+      if(index < 0) relative |= 4;
+    }
+  }
+  return p;
+}
+
+/* append a corner, remembering which of its indices are chunk-relative
+  -- don't use this function */
+inline void obj_push_corner_(obj_data &d, const obj_corner &c,
+    unsigned relative, obj_chunk_ *chunk) {
+  if(chunk != NULL && relative != 0) {
+    const std::size_t at = 3*d.corners.size();
+    for(unsigned i=0; i<3; ++i) {
+      if(relative & (1u << i)) chunk->fixups.push_back(at + i);
+    }
+  }
+  d.corners.push_back(c);
+}
+
+/* parse OBJ text -- don't use this function.  see parse_obj and
+  parse_obj_parallel; chunk is non-NULL when parsing one chunk of a
+  larger file into chunk->data */
+inline void obj_parse_(const char *begin, const char *end, obj_data &d,
+    obj_chunk_ *chunk) {
+  const char *p = begin;
+  while(p != end) {
+    p = obj_skip_space_(p, end);
+    if(p == end) break;
+    const char c0 = *p;
+    const char c1 = (p + 1 != end) ? p[1] : '\n';
+    if(c0 == 'v' && obj_is_space_(c1)) { // location
+      vector<3, float> v;
+      p = obj_parse_float(p + 1, end, v(0));
+      p = obj_parse_float(p, end, v(1));
+      p = obj_parse_float(p, end, v(2));
+      d.locs.push_back(v);
+    } else if(c0 == 'v' && c1 == 'n') { // normal
+      vector<3, float> v;
+      p = obj_parse_float(p + 2, end, v(0));
+      p = obj_parse_float(p, end, v(1));
+      p = obj_parse_float(p, end, v(2));
+      d.norms.push_back(v);
+    } else if(c0 == 'v' && c1 == 't') { // uv coordinates
+      vector<2, float> v;
+      p = obj_parse_float(p + 2, end, v(0));
+      p = obj_parse_float(p, end, v(1));
+      d.uvs.push_back(v);
+    } else if(c0 == 'f' && obj_is_space_(c1)) { // face
+      obj_corner first, prev, cur;
+      unsigned first_rel = 0, prev_rel = 0, cur_rel = 0;
+      int num_corners = 0;
+      p = obj_skip_space_(p + 1, end);
+      while(p != end && *p != '\n' && *p != '#') {
+        p = obj_parse_corner_(p, end, d, cur, cur_rel, chunk);
+        if(num_corners == 0) {
+          first = cur;
+          first_rel = cur_rel;
+        } else if(num_corners >= 2) {
+          obj_push_corner_(d, first, first_rel, chunk);
+          obj_push_corner_(d, prev, prev_rel, chunk);
+          obj_push_corner_(d, cur, cur_rel, chunk);
+        }
+        prev = cur;
+        prev_rel = cur_rel;
+        ++num_corners;
+        p = obj_skip_space_(p, end);
+      }
+      if(num_corners < 3) {
+        throw std::runtime_error(
+          "couldn't understand OBJ file (face with fewer than 3 corners)");
+      }
+    }
+    p = obj_skip_line_(p, end);
+  }
+}
+
+/**
+  \brief parse OBJ text, appending its contents to d
+  Polygons with more than three corners are fan-triangulated.  Relative
+  (negative) indices are resolved against the data parsed so far.
+  \param begin - beginning of OBJ text
+  \param end - end of OBJ text
+  \param d - destination
+  \throws std::runtime_error on malformed input
+ */
+inline void parse_obj(const char *begin, const char *end, obj_data &d) {
+  obj_parse_(begin, end, d, NULL);
+}
+
+/* first line start at or after p -- don't use this function */
+inline const char* obj_line_start_(const char *begin, const char *p,
+    const char *end) {
+  if(p == begin) return p;
+  return obj_skip_line_(p - 1, end);
+}
+
+/* parses the line-aligned chunks of a block -- don't use this */
+struct obj_parse_chunks_ {
+  obj_parse_chunks_(const char *begin, const char *end,
+      std::vector<obj_chunk_> &chunks)
+    : begin_(begin), end_(end), chunks_(chunks) { }
+
+  void operator()(std::size_t block, std::size_t first, std::size_t last) {
+    const char *b = obj_line_start_(begin_, begin_ + first, end_);
+    const char *e = obj_line_start_(begin_, begin_ + last, end_);
+    if(b < e) obj_parse_(b, e, chunks_[block].data, &chunks_[block]);
+  }
+
+  const char *begin_;
+  const char *end_;
+  std::vector<obj_chunk_> &chunks_;
+};
+
+/* place a parsed chunk after offset[a] of each attribute a, checking its
+  absolute indices and shifting its relative ones; corners are the
+  chunk's corners wherever they now live -- don't use this function */
+inline void obj_shift_chunk_(const obj_chunk_ &chunk, obj_corner *corners,
+    const int64_t offset[3]) {
+  for(int a=0; a<3; ++a) {
+    if(offset[a] < chunk.min_offset[a]) {
+      throw std::runtime_error("couldn't understand OBJ file (bad index)");
+    }
+  }
+  const std::vector<std::size_t> &fixups = chunk.fixups;
+  for(std::size_t i=0; i<fixups.size(); ++i) {
+    obj_corner &corner = corners[fixups[i] / 3];
+    int32_t &index = fixups[i] % 3 == 0 ? corner.v
+      : (fixups[i] % 3 == 1 ? corner.vt : corner.vn);
+    const int64_t shifted = index + offset[fixups[i] % 3];
+    if(shifted < 0) {
+      throw std::runtime_error("couldn't understand OBJ file (bad index)");
+    }
+    index = obj_narrow_index_(shifted);
+  }
+}
+
+/* copies chunks into their place in the merged data -- don't use this */
+struct obj_merge_chunks_ {
+  obj_merge_chunks_(std::vector<obj_chunk_> &chunks, obj_data &d,
+      const std::vector<std::size_t> &offsets)
+    : chunks_(chunks), d_(d), offsets_(offsets) { }
+
+  void operator()(std::size_t, std::size_t first, std::size_t last) {
+    for(std::size_t c=first; c<last; ++c) {
+      const obj_data &src = chunks_[c].data;
+      const std::size_t *off = &offsets_[4*c];
+      std::copy(src.locs.begin(), src.locs.end(), d_.locs.begin() + off[0]);
+      std::copy(src.norms.begin(), src.norms.end(),
+        d_.norms.begin() + off[1]);
+      std::copy(src.uvs.begin(), src.uvs.end(), d_.uvs.begin() + off[2]);
+      std::copy(src.corners.begin(), src.corners.end(),
+        d_.corners.begin() + off[3]);
+
+      // every index now refers to data before it, as in parse_obj
+      if(!src.corners.empty()) {
+        const int64_t shift[3] = {
+          static_cast<int64_t>(off[0]), static_cast<int64_t>(off[2]),
+          static_cast<int64_t>(off[1])
+        };
+        obj_shift_chunk_(chunks_[c], &d_.corners[0] + off[3], shift);
+      }
+      chunks_[c] = obj_chunk_();
+    }
+  }
+
+  std::vector<obj_chunk_> &chunks_;
+  obj_data &d_;
+  const std::vector<std::size_t> &offsets_;
+};
+
+/**
+  \brief parse OBJ text on several threads, replacing the contents of d
+  The text is split at line boundaries into one chunk per thread.  Each
+  chunk is parsed into its own arrays, then the arrays are concatenated
+  using prefix sums of their sizes, shifting relative (negative) indices
+  that reach into earlier chunks.  Produces exactly what parse_obj would,
+  and rejects what it would reject, including indices to data that
+  appears later in the file.
+  \param begin - beginning of OBJ text
+  \param end - end of OBJ text
+  \param d - destination
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+  \throws std::runtime_error on malformed input
+ */
+inline void parse_obj_parallel(const char *begin, const char *end,
+    obj_data &d, unsigned threads = 0) {
+  const std::size_t size = end - begin;
+  const std::size_t min_chunk = 1 << 20;
+  const std::size_t num_chunks = parallel_num_blocks(size, min_chunk,
+    threads);
+  if(num_chunks <= 1) {
+    d = obj_data();
+    parse_obj(begin, end, d);
+    return;
+  }
+
+  std::vector<obj_chunk_> chunks(num_chunks);
+  obj_parse_chunks_ parse(begin, end, chunks);
+  parallel_for_blocks(0, size, parse, min_chunk, threads);
+
+  std::vector<std::size_t> offsets(4*num_chunks);
+  std::size_t totals[4] = { 0, 0, 0, 0 };
+  for(std::size_t c=0; c<num_chunks; ++c) {
+    const obj_data &cd = chunks[c].data;
+    const std::size_t sizes[4] = {
+      cd.locs.size(), cd.norms.size(), cd.uvs.size(), cd.corners.size()
+    };
+    for(int k=0; k<4; ++k) {
+      offsets[4*c + k] = totals[k];
+      totals[k] += sizes[k];
+    }
+  }
+  d.locs.resize(totals[0]);
+  d.norms.resize(totals[1]);
+  d.uvs.resize(totals[2]);
+  d.corners.resize(totals[3]);
+
+  obj_merge_chunks_ merge(chunks, d, offsets);
+  parallel_for_blocks(0, num_chunks, merge, 1, threads);
+}
+
+}
+
+#endif
+
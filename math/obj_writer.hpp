@@ -0,0 +1,356 @@
+#ifndef _GHP_MATH_OBJ_WRITER_HPP_
+#define _GHP_MATH_OBJ_WRITER_HPP_
+
+#include "obj_parser.hpp"
+#include "vector.hpp"
+#include "vertex_aux.hpp"
+#include "../util/parallel.hpp"
+
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+namespace ghp {
+
+/*
+  Text output for wavefront OBJ.  Numbers are formatted by hand into
+  large buffers, never through iostreams or printf, and blocks of lines
+  are formatted in parallel before being written in order.
+ */
+
+/* x * 10^e, one rounding per factor of 10^22 -- don't use this */
+inline double obj_scale10_(double x, int e) {
+  for(; e > 22; e -= 22) x *= obj_pow10_(22);
+  for(; e < -22; e += 22) x /= obj_pow10_(22);
+  return e >= 0 ? x * obj_pow10_(e) : x / obj_pow10_(-e);
+}
+
+/* writes the decimal digits of n, returns one past the last -- don't use
+  this */
+inline char* obj_format_uint_(uint32_t n, char *out) {
+  char digits[10];
+  int count = 0;
+  do {
+    digits[count++] = static_cast<char>('0' + n % 10);
+    n /= 10;
+  } while(n != 0);
+  while(count > 0) *out++ = digits[--count];
+  return out;
+}
+
+/* true if digits * 10^exponent reads back as the float x, whose
+  neighbours are half a gap below and above away; the result is only
+  trusted with a margin far wider than the error of the double arithmetic
+  -- don't use this */
+inline bool obj_round_trips_(uint32_t digits, int exponent, double x,
+    double below, double above, bool even) {
+  const double c = obj_scale10_(digits, exponent);
+  // a decimal exactly halfway reads back as the even neighbour; only
+  // whole numbers below 2^53 are computed exactly enough to tell
+  if(even && exponent >= 0 && c < 9007199254740992.0
+      && (c - x == above || x - c == below)) {
+    return true;
+  }
+  const double margin = 1 - 1.0 / (1 << 20);
+  return c >= x ? c - x < above*margin : x - c < below*margin;
+}
+
+/**
+  \brief format a float as the shortest decimal that reads back exactly
+  Finds the fewest significant digits (at most 9) whose decimal rounds
+  back to f, in plain notation for moderate exponents and scientific
+  notation otherwise.  The digits are found in double arithmetic and
+  checked against the gaps to f's neighbours with a wide margin, so on
+  the rare value too close to call one more digit than strictly needed
+  may be written, but the output always round-trips.
+  \param f - value to format
+  \param out - buffer with room for at least 16 characters
+  \returns one past the last character written; no terminator is added
+ */
+inline char* obj_format_float(float f, char *out) {
+  uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  if(bits >> 31) *out++ = '-';
+  bits &= 0x7fffffff;
+  if(bits >= 0x7f800000) {
+    std::memcpy(out, bits == 0x7f800000 ? "inf" : "nan", 3);
+    return out + 3;
+  }
+  if(bits == 0) {
+    *out = '0';
+    return out + 1;
+  }
+
+  // gaps to the neighbouring floats, exact in double
+  float down_f, up_f;
+  const uint32_t down_bits = bits - 1, up_bits = bits + 1;
+  std::memcpy(&down_f, &down_bits, sizeof(down_f));
+  std::memcpy(&up_f, &up_bits, sizeof(up_f));
+  const double x = std::fabs(static_cast<double>(f));
+  const double below = (x - down_f) / 2;
+  const double above = up_bits == 0x7f800000 ? below : (up_f - x) / 2;
+  const bool even = (bits & 1) == 0;
+
+  // decimal exponent from the binary one, then corrected
+  int binary_exponent = static_cast<int>(bits >> 23) - 127;
+  if(binary_exponent == -127) {
+    std::frexp(x, &binary_exponent);
+    --binary_exponent;
+  }
+  int k = static_cast<int>(std::floor(binary_exponent * 0.30103));
+  const double lead = obj_scale10_(x, -k);
+  if(lead >= 10) ++k;
+  else if(lead < 1) --k;
+
+  // fewest digits that round-trip, by bisection; 9 always do
+  uint32_t best = 0;
+  int best_exponent = 0;
+  int lo = 1, hi = 9;
+  while(lo <= hi) {
+    const int p = (lo + hi) / 2;
+    const int exponent = k - p + 1;
+    const double scaled = obj_scale10_(x, -exponent);
+    uint32_t digits = static_cast<uint32_t>(scaled + 0.5);
+    bool ok = obj_round_trips_(digits, exponent, x, below, above, even);
+    if(!ok && below != above) {
+      // the gaps differ at powers of two, so the other neighbour can fit
+      // where the nearest doesn't
+      const uint32_t other = static_cast<double>(digits) > scaled
+        ? digits - 1 : digits + 1;
+      if(other > 0 && obj_round_trips_(other, exponent, x, below,
+          above, even)) {
+        digits = other;
+        ok = true;
+      }
+    }
+    if(ok || p == 9) {
+      best = digits;
+      best_exponent = exponent;
+      hi = p - 1;
+    } else {
+      lo = p + 1;
+    }
+  }
+
+  while(best % 10 == 0) {
+    best /= 10;
+    ++best_exponent;
+  }
+  char digits[10];
+  char *end = obj_format_uint_(best, digits);
+  const int count = end - digits;
+  // position of the decimal point relative to the first digit
+  const int point = count + best_exponent;
+  if(point > 9 || point < -3) {
+    *out++ = digits[0];
+    if(count > 1) {
+      *out++ = '.';
+      std::memcpy(out, digits + 1, count - 1);
+      out += count - 1;
+    }
+    *out++ = 'e';
+    int e = point - 1;
+    if(e < 0) {
+      *out++ = '-';
+      e = -e;
+    }
+    return obj_format_uint_(e, out);
+  }
+  if(point <= 0) {
+    *out++ = '0';
+    *out++ = '.';
+    for(int i=point; i<0; ++i) *out++ = '0';
+    std::memcpy(out, digits, count);
+    return out + count;
+  }
+  if(point >= count) {
+    std::memcpy(out, digits, count);
+    out += count;
+    for(int i=count; i<point; ++i) *out++ = '0';
+    return out;
+  }
+  std::memcpy(out, digits, point);
+  out += point;
+  *out++ = '.';
+  std::memcpy(out, digits + point, count - point);
+  return out + count - point;
+}
+
+/* formats one kind of OBJ line for a range of elements into per-block
+  buffers -- don't use this */
+template<typename M>
+class obj_format_blocks_ {
+public:
+  enum kind { locations, normals, uvs, faces };
+
+  obj_format_blocks_(const M &m, kind k, bool with_normals, bool with_uvs,
+      std::vector<std::vector<char> > &buffers,
+      std::vector<std::size_t> &sizes)
+    : m_(m), kind_(k), normals_(with_normals), uvs_(with_uvs),
+    buffers_(buffers), sizes_(sizes) { }
+
+  void operator()(std::size_t block, std::size_t begin, std::size_t end) {
+    typedef typename M::const_vertex_access_t access_t;
+    // longest possible line, for each kind
+    const std::size_t line = kind_ == faces ? 2 + 3*(3*11 + 1) : 3 + 3*17;
+    std::vector<char> &buffer = buffers_[block];
+    if(buffer.size() < (end - begin)*line) buffer.resize((end - begin)*line);
+    char *out = &buffer[0];
+    for(std::size_t i=begin; i<end; ++i) {
+      switch(kind_) {
+      case locations: {
+        vector<3, float> v;
+        vertex_read_loc<access_t>()(m_.vertices(i), v);
+        *out++ = 'v';
+        for(int c=0; c<3; ++c) {
+          *out++ = ' ';
+          out = obj_format_float(v(c), out);
+        }
+        break;
+      }
+      case normals: {
+        vector<3, float> n;
+        vertex_read_norm<access_t>()(m_.vertices(i), n);
+        *out++ = 'v';
+        *out++ = 'n';
+        for(int c=0; c<3; ++c) {
+          *out++ = ' ';
+          out = obj_format_float(n(c), out);
+        }
+        break;
+      }
+      case uvs: {
+        vector<2, float> uv;
+        vertex_read_uv<access_t>()(m_.vertices(i), uv);
+        *out++ = 'v';
+        *out++ = 't';
+        for(int c=0; c<2; ++c) {
+          *out++ = ' ';
+          out = obj_format_float(uv(c), out);
+        }
+        break;
+      }
+      case faces:
+        *out++ = 'f';
+        for(int c=0; c<3; ++c) {
+          // every attribute shares the vertex's (1-based) index
+          const uint32_t index = m_.faces(i)[c] + 1;
+          *out++ = ' ';
+          out = obj_format_uint_(index, out);
+          if(uvs_ || normals_) {
+            *out++ = '/';
+            if(uvs_) out = obj_format_uint_(index, out);
+          }
+          if(normals_) {
+            *out++ = '/';
+            out = obj_format_uint_(index, out);
+          }
+        }
+        break;
+      }
+      *out++ = '\n';
+    }
+    sizes_[block] = out - &buffer[0];
+  }
+
+private:
+  const M &m_;
+  kind kind_;
+  bool normals_;
+  bool uvs_;
+  std::vector<std::vector<char> > &buffers_;
+  std::vector<std::size_t> &sizes_;
+};
+
+/* owns the output file -- don't use this */
+class obj_file_writer_ : public boost::noncopyable {
+public:
+  explicit obj_file_writer_(const std::string &path)
+      : file_(std::fopen(path.c_str(), "wb")), path_(path) {
+    if(file_ == NULL) {
+      throw std::runtime_error("couldn't open file for writing " + path);
+    }
+    // the blocks are already large, so fwrite needn't copy them again
+    std::setvbuf(file_, NULL, _IONBF, 0);
+  }
+  ~obj_file_writer_() {
+    if(file_ != NULL) std::fclose(file_);
+  }
+
+  void write(const void *data, std::size_t size) {
+    if(size != 0 && std::fwrite(data, 1, size, file_) != size) {
+      throw std::runtime_error("couldn't write file " + path_);
+    }
+  }
+  void close() {
+    const int result = std::fclose(file_);
+    file_ = NULL;
+    if(result != 0) {
+      throw std::runtime_error("couldn't write file " + path_);
+    }
+  }
+
+private:
+  std::FILE *file_;
+  std::string path_;
+};
+
+/**
+  \brief save a mesh as a wavefront OBJ file
+  Lines are formatted a batch at a time, the batch split across threads,
+  and written in order, so memory use stays bounded however large the
+  mesh is.  Each vertex writes one v line and, if requested, matching vn
+  and vt lines, so faces use the same index for every attribute.
+  \tparam M - supports mesh concept
+  \param path - path of file to write
+  \param m - mesh to save
+  \param with_normals - write vn lines
+  \param with_uvs - write vt lines
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+  \throws std::runtime_error if the file can't be written
+ */
+template<typename M>
+void save_obj_mesh(const std::string &path, const M &m,
+    bool with_normals = true, bool with_uvs = true, unsigned threads = 0) {
+  typedef obj_format_blocks_<M> format_t;
+  const std::size_t min_block = 1 << 14;
+  if(threads == 0) threads = hardware_threads();
+  const std::size_t batch = min_block * threads * 4;
+
+  obj_file_writer_ out(path);
+  std::vector<std::vector<char> > buffers(threads);
+  std::vector<std::size_t> sizes(threads);
+  const typename format_t::kind kinds[] = {
+    format_t::locations, format_t::normals, format_t::uvs, format_t::faces
+  };
+  for(int k=0; k<4; ++k) {
+    if(kinds[k] == format_t::normals && !with_normals) continue;
+    if(kinds[k] == format_t::uvs && !with_uvs) continue;
+    const std::size_t n = kinds[k] == format_t::faces
+      ? m.num_faces() : m.num_vertices();
+    format_t format(m, kinds[k], with_normals, with_uvs, buffers, sizes);
+    for(std::size_t b=0; b<n; b+=batch) {
+      const std::size_t e = std::min(n, b + batch);
+      const std::size_t blocks = parallel_num_blocks(e - b, min_block,
+        threads);
+      parallel_for_blocks(b, e, format, min_block, threads);
+      for(std::size_t i=0; i<blocks; ++i) {
+        if(sizes[i] > 0) out.write(&buffers[i][0], sizes[i]);
+      }
+    }
+  }
+  out.close();
+}
+
+}
+
+#endif
+
@@ -0,0 +1,297 @@
+#ifndef _GHP_MATH_SUBDIVISION_HPP_
+#define _GHP_MATH_SUBDIVISION_HPP_
+
+#include "half_edge.hpp"
+#include "mesh_normals.hpp"
+#include "vector.hpp"
+#include "vertex_aux.hpp"
+#include "../util/parallel.hpp"
+
+#include <vector>
+
+#include <cmath>
+
+namespace ghp {
+
+/* faces of one subdivision level, shaped enough like a mesh for
+  half_edge_mesh -- don't use this */
+struct subdivision_level_ {
+  int nv;
+  std::vector<int> faces_;
+
+  inline int num_vertices() const { return nv; }
+  inline int num_faces() const { return faces_.size() / 3; }
+  inline const int* faces(int f) const { return &faces_[3*f]; }
+};
+
+/* sparse rows, compressed: row i is entries offsets[i] ... offsets[i + 1]
+  -- don't use this */
+struct subdivision_stencils_ {
+  std::vector<int> offsets;
+  std::vector<int> sources;
+  std::vector<float> weights;
+
+  inline void add(int source, float weight) {
+    sources.push_back(source);
+    weights.push_back(weight);
+  }
+  inline void end_row() { offsets.push_back(sources.size()); }
+};
+
+/* evaluates rows of a stencil table -- don't use this */
+template<typename T>
+struct subdivision_apply_ {
+  subdivision_apply_(const subdivision_stencils_ &s, const T *in, T *out)
+    : s_(s), in_(in), out_(out) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    const int *offsets = &s_.offsets[0];
+    const int *sources = &s_.sources[0];
+    const float *weights = &s_.weights[0];
+    for(std::size_t i=begin; i<end; ++i) {
+      T sum = in_[sources[offsets[i]]] * weights[offsets[i]];
+      for(int j=offsets[i] + 1; j<offsets[i + 1]; ++j) {
+        sum += in_[sources[j]] * weights[j];
+      }
+      out_[i] = sum;
+    }
+  }
+
+  const subdivision_stencils_ &s_;
+  const T *in_;
+  T *out_;
+};
+
+/**
+  \brief Loop subdivision of a triangle mesh, as a stencil table
+  Refining a mesh by some number of levels is linear in its vertices,
+  so the whole refinement is precomputed once from the control mesh's
+  topology: every refined vertex is a fixed weighted sum of control
+  vertices.  Evaluating the refined surface for new control vertex
+  positions, e.g. an animated cage, is then a sparse matrix-vector
+  product over independent rows, split across threads, with no topology
+  work at all.  Boundaries (including vertices split at uv seams) use the
+  usual crease rules; non-manifold vertices are held in place.
+  Degenerate control faces, which repeat a vertex, are dropped: they
+  have no area, and refining them would leave slivers hanging off the
+  surface.
+ */
+class loop_subdivision {
+public:
+  /** \brief precompute the refinement of a control mesh
+    \tparam M - supports mesh concept
+    \param control - control mesh; only its faces are used
+    \param levels - number of times to subdivide
+   */
+  template<typename M>
+  loop_subdivision(const M &control, int levels)
+      : num_control_(control.num_vertices()) {
+    subdivision_level_ level;
+    level.nv = control.num_vertices();
+    level.faces_.reserve(3*control.num_faces());
+    for(int f=0; f<control.num_faces(); ++f) {
+      const int a = control.faces(f)[0];
+      const int b = control.faces(f)[1];
+      const int c = control.faces(f)[2];
+      if(a == b || b == c || c == a) continue;
+      level.faces_.push_back(a);
+      level.faces_.push_back(b);
+      level.faces_.push_back(c);
+    }
+
+    // start from the identity
+    stencils_.offsets.push_back(0);
+    for(int i=0; i<level.nv; ++i) {
+      stencils_.add(i, 1);
+      stencils_.end_row();
+    }
+    for(int l=0; l<levels; ++l) {
+      subdivision_stencils_ step;
+      subdivision_level_ next;
+      subdivide_(level, step, next);
+      compose_(step);
+      level.nv = next.nv;
+      level.faces_.swap(next.faces_);
+    }
+    faces_.swap(level.faces_);
+  }
+
+  /** \brief number of control vertices the table expects */
+  inline int num_control_vertices() const { return num_control_; }
+  /** \brief number of refined vertices */
+  inline int num_vertices() const { return stencils_.offsets.size() - 1; }
+  /** \brief number of refined triangles */
+  inline int num_faces() const { return faces_.size() / 3; }
+  /** \brief refined triangles, three vertex indices each */
+  inline const std::vector<int>& faces() const { return faces_; }
+
+  /** \brief evaluate refined values from control values
+    \tparam T - supports addition and multiplication by a float, e.g.
+      float or vector<N, float>
+    \param in - one value per control vertex
+    \param out - receives one value per refined vertex
+    \param threads - maximum number of threads; 0 uses hardware_threads()
+   */
+  template<typename T>
+  void apply(const T *in, T *out, unsigned threads = 0) const {
+    subdivision_apply_<T> apply(stencils_, in, out);
+    parallel_for_blocks(0, num_vertices(), apply, 1 << 12, threads);
+  }
+
+  /** \brief refine a mesh
+    Locations and uvs are evaluated through the stencils, normals are
+    recomputed on the refined surface.  After the first call with a
+    given output mesh, only vertex data changes, so refining again for a
+    moved cage reuses out's storage.
+    \tparam M - supports mesh concept
+    \tparam M2 - supports mesh concept
+    \param control - control mesh, with the topology the table was built
+      from
+    \param out - receives the refined mesh
+    \param threads - maximum number of threads; 0 uses hardware_threads()
+   */
+  template<typename M, typename M2>
+  void refine(const M &control, M2 &out, unsigned threads = 0) const {
+    typedef typename M::const_vertex_access_t in_t;
+    typedef typename M2::vertex_access_t out_t;
+    const int nv = num_vertices();
+    if(out.num_vertices() != nv || out.num_faces() != num_faces()) {
+      out.resize_vertices(nv);
+      out.resize_faces(num_faces());
+      for(int f=0; f<num_faces(); ++f) {
+        for(int k=0; k<3; ++k) out.faces(f)[k] = faces_[3*f + k];
+      }
+    }
+
+    std::vector<vector<3, float> > locs(num_control_), refined_locs(nv);
+    std::vector<vector<2, float> > uvs(num_control_), refined_uvs(nv);
+    for(int i=0; i<num_control_; ++i) {
+      vertex_read_loc<in_t>()(control.vertices(i), locs[i]);
+      vertex_read_uv<in_t>()(control.vertices(i), uvs[i]);
+    }
+    if(nv > 0 && num_control_ > 0) {
+      apply(&locs[0], &refined_locs[0], threads);
+      apply(&uvs[0], &refined_uvs[0], threads);
+    }
+    for(int i=0; i<nv; ++i) {
+      vertex_write_loc<out_t>()(out.vertices(i), refined_locs[i]);
+      vertex_write_uv<out_t>()(out.vertices(i), refined_uvs[i]);
+    }
+    compute_smooth_normals(out, normal_weight_angle, false, threads);
+  }
+
+private:
+  // one level of Loop's rules as a stencil table, plus the finer faces
+  static void subdivide_(const subdivision_level_ &level,
+      subdivision_stencils_ &step, subdivision_level_ &next) {
+    const half_edge_mesh he(level);
+    const int nv = level.nv;
+    const int nh = he.num_half_edges();
+
+    // every edge gets an id, through its lower numbered half-edge
+    std::vector<int> edge_id(nh);
+    int num_edges = 0;
+    for(int h=0; h<nh; ++h) {
+      const int t = he.twin(h);
+      edge_id[h] = (t < 0 || h < t) ? num_edges++ : edge_id[t];
+    }
+    std::vector<int> degree(nv, 0);
+    for(int h=0; h<nh; ++h) ++degree[he.from(h)];
+
+    step.offsets.assign(1, 0);
+    std::vector<int> ring;
+    for(int v=0; v<nv; ++v) {
+      he.one_ring(v, ring);
+      const int n = ring.size();
+      const bool boundary = he.boundary_vertex(v);
+      // a lone fan covers every face at a manifold vertex
+      const int faces_seen = boundary ? n - 1 : n;
+      if(n == 0 || faces_seen != degree[v] || (boundary && n < 2)) {
+        step.add(v, 1);
+      } else if(boundary) {
+        step.add(v, 0.75f);
+        step.add(ring.front(), 0.125f);
+        step.add(ring.back(), 0.125f);
+      } else {
+        const double c = 0.375 + 0.25*std::cos(2*M_PI / n);
+        const float beta = (0.625 - c*c) / n;
+        step.add(v, 1 - n*beta);
+        for(int i=0; i<n; ++i) step.add(ring[i], beta);
+      }
+      step.end_row();
+    }
+    for(int h=0; h<nh; ++h) {
+      const int t = he.twin(h);
+      if(t >= 0 && t < h) continue;
+      if(t < 0) {
+        step.add(he.from(h), 0.5f);
+        step.add(he.to(h), 0.5f);
+      } else {
+        step.add(he.from(h), 0.375f);
+        step.add(he.to(h), 0.375f);
+        step.add(he.from(half_edge_mesh::prev(h)), 0.125f);
+        step.add(he.from(half_edge_mesh::prev(t)), 0.125f);
+      }
+      step.end_row();
+    }
+
+    next.nv = nv + num_edges;
+    next.faces_.resize(4*nh);
+    for(int f=0; f<level.num_faces(); ++f) {
+      const int *v = level.faces(f);
+      const int m[3] = {
+        nv + edge_id[3*f], nv + edge_id[3*f + 1], nv + edge_id[3*f + 2]
+      };
+      int *out = &next.faces_[12*f];
+      out[0] = v[0]; out[1] = m[0]; out[2] = m[2];
+      out[3] = m[0]; out[4] = v[1]; out[5] = m[1];
+      out[6] = m[2]; out[7] = m[1]; out[8] = v[2];
+      out[9] = m[0]; out[10] = m[1]; out[11] = m[2];
+    }
+  }
+
+  // replace the table with step * table, merging rows in a dense
+  // accumulator over the control vertices
+  void compose_(const subdivision_stencils_ &step) {
+    subdivision_stencils_ result;
+    result.offsets.push_back(0);
+    std::vector<float> sums(num_control_, 0);
+    std::vector<char> used(num_control_, 0);
+    std::vector<int> touched;
+    const int rows = step.offsets.size() - 1;
+    for(int r=0; r<rows; ++r) {
+      touched.clear();
+      for(int j=step.offsets[r]; j<step.offsets[r + 1]; ++j) {
+        const int row = step.sources[j];
+        const float w = step.weights[j];
+        for(int k=stencils_.offsets[row]; k<stencils_.offsets[row + 1]; ++k) {
+          const int s = stencils_.sources[k];
+          if(!used[s]) {
+            used[s] = 1;
+            touched.push_back(s);
+          }
+          sums[s] += w * stencils_.weights[k];
+        }
+      }
+      for(std::size_t i=0; i<touched.size(); ++i) {
+        const int s = touched[i];
+        result.add(s, sums[s]);
+        sums[s] = 0;
+        used[s] = 0;
+      }
+      result.end_row();
+    }
+    stencils_.offsets.swap(result.offsets);
+    stencils_.sources.swap(result.sources);
+    stencils_.weights.swap(result.weights);
+  }
+
+  int num_control_;
+  subdivision_stencils_ stencils_;
+  std::vector<int> faces_;
+};
+
+}
+
+#endif
+
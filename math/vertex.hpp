@@ -70,6 +70,90 @@ struct vertex_read_norm<ln_vertex<N, T> > {
   }
 };
 
+/**
+  \brief vertex containing location, normal and texture coordinates
+  \tparam N - dimension of space vertex exists in
+  \tparam T - underlying floating point type
+ */
+template<int N, typename T>
+class lnu_vertex {
+public:
+  typedef vector<N, T> vector_t;
+  typedef vector<2, T> uv_t;
+
+  /** \brief create a new lnu_vertex */
+  lnu_vertex() { }
+  /** \brief create a new lnu_vertex */
+  lnu_vertex(const vector_t &loc, const vector_t &norm, const uv_t &uv)
+      : loc_(loc), norm_(norm), uv_(uv) { }
+  ~lnu_vertex() { }
+
+  /** \brief element access */
+  inline vector_t& location() { return loc_; }
+  /** \brief element access */
+  inline const vector_t& location() const { return loc_; }
+  /** \brief element access */
+  inline vector_t& normal() { return norm_; }
+  /** \brief element access */
+  inline const vector_t& normal() const { return norm_; }
+  /** \brief element access */
+  inline uv_t& uv() { return uv_; }
+  /** \brief element access */
+  inline const uv_t& uv() const { return uv_; }
+
+private:
+  vector_t loc_;
+  vector_t norm_;
+  uv_t uv_;
+};
+
+//
+// adapters/template magic for lnu_vertex
+template<int N, typename T>
+struct vertex_write_loc<lnu_vertex<N, T> > {
+  template<typename S>
+  inline void operator()(lnu_vertex<N, T> &v, const S &s) {
+    v.location() = s;
+  }
+};
+template<int N, typename T>
+struct vertex_read_loc<lnu_vertex<N, T> > {
+  template<typename S>
+  inline void operator()(const lnu_vertex<N, T> &v, S &s) {
+    s = v.location();
+  }
+};
+
+template<int N, typename T>
+struct vertex_write_norm<lnu_vertex<N, T> > {
+  template<typename S>
+  inline void operator()(lnu_vertex<N, T> &v, const S &s) {
+    v.normal() = s;
+  }
+};
+template<int N, typename T>
+struct vertex_read_norm<lnu_vertex<N, T> > {
+  template<typename S>
+  inline void operator()(const lnu_vertex<N, T> &v, S &s) {
+    s = v.normal();
+  }
+};
+
+template<int N, typename T>
+struct vertex_write_uv<lnu_vertex<N, T> > {
+  template<typename S>
+  inline void operator()(lnu_vertex<N, T> &v, const S &s) {
+    v.uv() = s;
+  }
+};
+template<int N, typename T>
+struct vertex_read_uv<lnu_vertex<N, T> > {
+  template<typename S>
+  inline void operator()(const lnu_vertex<N, T> &v, S &s) {
+    s = v.uv();
+  }
+};
+
 template<typename V>
 class vertex : public V {
 public:
@@ -111,6 +195,21 @@ public:
   }
 };
 
+//
+// vertex<V> is read and written through its backend's adapters
+template<typename V>
+struct vertex_write_loc<vertex<V> > : public vertex_write_loc<V> { };
+template<typename V>
+struct vertex_read_loc<vertex<V> > : public vertex_read_loc<V> { };
+template<typename V>
+struct vertex_write_norm<vertex<V> > : public vertex_write_norm<V> { };
+template<typename V>
+struct vertex_read_norm<vertex<V> > : public vertex_read_norm<V> { };
+template<typename V>
+struct vertex_write_uv<vertex<V> > : public vertex_write_uv<V> { };
+template<typename V>
+struct vertex_read_uv<vertex<V> > : public vertex_read_uv<V> { };
+
 }
 
 #endif
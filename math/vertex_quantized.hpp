@@ -0,0 +1,412 @@
+#ifndef _GHP_MATH_VERTEX_QUANTIZED_HPP_
+#define _GHP_MATH_VERTEX_QUANTIZED_HPP_
+
+#include "vector.hpp"
+#include "vertex.hpp"
+#include "vertex_aux.hpp"
+#include "../util/parallel.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+namespace ghp {
+
+/**
+  \brief convert a float to an IEEE 754 half, rounding to nearest even
+  \param f - value to convert; out of range values become infinity
+ */
+inline uint16_t float_to_half(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  const uint16_t sign = (x >> 16) & 0x8000;
+  const uint32_t abs = x & 0x7fffffff;
+  if(abs >= 0x7f800000) { // inf or nan
+    return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+  }
+  if(abs >= 0x477ff000) return sign | 0x7c00; // rounds past 65504
+  if(abs < 0x38800000) { // half subnormal or zero
+    if(abs < 0x33000000) return sign;
+    const uint32_t shift = 126 - (abs >> 23);
+    const uint32_t mant = (abs & 0x7fffff) | 0x800000;
+    uint32_t h = mant >> shift;
+    const uint32_t rest = mant & ((1u << shift) - 1);
+    const uint32_t half = 1u << (shift - 1);
+    if(rest > half || (rest == half && (h & 1))) ++h;
+    return sign | h;
+  }
+  uint32_t h = (abs - 0x38000000) >> 13;
+  const uint32_t rest = abs & 0x1fff;
+  if(rest > 0x1000 || (rest == 0x1000 && (h & 1))) ++h;
+  return sign | h;
+}
+
+/** \brief convert an IEEE 754 half to a float, exactly */
+inline float half_to_float(uint16_t h) {
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  const uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t x;
+  if(exp == 0x1f) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else if(exp != 0) {
+    x = sign | ((exp + 112) << 23) | (mant << 13);
+  } else if(mant == 0) {
+    x = sign;
+  } else {
+    // subnormal half: normalize into a float
+    int e = 113;
+    while(!(mant & 0x400)) {
+      mant <<= 1;
+      --e;
+    }
+    x = sign | (static_cast<uint32_t>(e) << 23) | ((mant & 0x3ff) << 13);
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+/* float in [-1, 1] or [0, 1] to fixed point, rounding -- don't use this */
+inline int32_t quantize_round_(float f, float scale) {
+  const float s = f * scale;
+  return static_cast<int32_t>(s >= 0 ? s + 0.5f : s - 0.5f);
+}
+
+/**
+  \brief octahedral encoding of a unit vector into two 16-bit snorms
+  The sphere is mapped onto an octahedron and unfolded onto a square,
+  which spends the bits far more evenly than storing x and y.
+  \param n - unit vector
+  \param out - receives the encoding
+ */
+inline void encode_octahedral(const vector<3, float> &n, int16_t out[2]) {
+  const float l1 = std::fabs(n(0)) + std::fabs(n(1)) + std::fabs(n(2));
+  float x = l1 > 0 ? n(0) / l1 : 0;
+  float y = l1 > 0 ? n(1) / l1 : 0;
+  if(n(2) < 0) {
+    const float fx = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+    const float fy = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+    x = fx;
+    y = fy;
+  }
+  out[0] = quantize_round_(std::max(-1.0f, std::min(1.0f, x)), 32767);
+  out[1] = quantize_round_(std::max(-1.0f, std::min(1.0f, y)), 32767);
+}
+
+/** \brief decode an octahedral encoding back into a unit vector */
+inline vector<3, float> decode_octahedral(const int16_t in[2]) {
+  float x = std::max(in[0] / 32767.0f, -1.0f);
+  float y = std::max(in[1] / 32767.0f, -1.0f);
+  const float z = 1 - std::fabs(x) - std::fabs(y);
+  if(z < 0) {
+    const float fx = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+    const float fy = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+    x = fx;
+    y = fy;
+  }
+  vector<3, float> n = vector3<float>(x, y, z);
+  const float len2 = n.norm2();
+  if(len2 > 0) n /= std::sqrt(len2);
+  return n;
+}
+
+/**
+  \brief 16-byte vertex with quantized attributes
+  Locations are 16-bit unorms over the mesh's bounding box (see
+  mesh_quantization), normals are octahedral-encoded 16-bit snorms and
+  uvs are half floats, half the size of an lnu_vertex<3, float>.  The
+  layout matches common GPU vertex formats so it can be uploaded as-is.
+  Through the vertex adapters locations read and write as normalized
+  [0, 1] coordinates; mesh_quantization maps them to and from the
+  original space.
+ */
+class quantized_vertex {
+public:
+  typedef vector<3, float> vector_t;
+  typedef vector<2, float> uv_t;
+
+  quantized_vertex() {
+    for(int i=0; i<4; ++i) loc[i] = 0;
+    norm[0] = norm[1] = 0;
+    uv[0] = uv[1] = 0;
+  }
+  ~quantized_vertex() { }
+
+  /** location, as unorm16, and one padding element */
+  uint16_t loc[4];
+  /** octahedral normal, as snorm16 */
+  int16_t norm[2];
+  /** uv, as half floats */
+  uint16_t uv[2];
+};
+
+//
+// adapters/template magic for quantized_vertex
+template<>
+struct vertex_write_loc<quantized_vertex> {
+  template<typename S>
+  inline void operator()(quantized_vertex &v, const S &s) {
+    for(int i=0; i<3; ++i) {
+      const float c = s(i) < 0 ? 0 : (s(i) > 1 ? 1 : s(i));
+      v.loc[i] = quantize_round_(c, 65535);
+    }
+  }
+};
+template<>
+struct vertex_read_loc<quantized_vertex> {
+  template<typename S>
+  inline void operator()(const quantized_vertex &v, S &s) {
+    for(int i=0; i<3; ++i) s(i) = v.loc[i] * (1 / 65535.0f);
+  }
+};
+
+template<>
+struct vertex_write_norm<quantized_vertex> {
+  template<typename S>
+  inline void operator()(quantized_vertex &v, const S &s) {
+    encode_octahedral(vector3<float>(s(0), s(1), s(2)), v.norm);
+  }
+};
+template<>
+struct vertex_read_norm<quantized_vertex> {
+  template<typename S>
+  inline void operator()(const quantized_vertex &v, S &s) {
+    const vector<3, float> n = decode_octahedral(v.norm);
+    for(int i=0; i<3; ++i) s(i) = n(i);
+  }
+};
+
+template<>
+struct vertex_write_uv<quantized_vertex> {
+  template<typename S>
+  inline void operator()(quantized_vertex &v, const S &s) {
+    v.uv[0] = float_to_half(s(0));
+    v.uv[1] = float_to_half(s(1));
+  }
+};
+template<>
+struct vertex_read_uv<quantized_vertex> {
+  template<typename S>
+  inline void operator()(const quantized_vertex &v, S &s) {
+    s(0) = half_to_float(v.uv[0]);
+    s(1) = half_to_float(v.uv[1]);
+  }
+};
+
+/** \brief maps quantized locations to and from the original space */
+struct mesh_quantization {
+  /** location of the bounding box's minimum corner */
+  vector<3, float> offset;
+  /** bounding box extent; the same on every axis so that quantization
+    keeps proportions */
+  float scale;
+
+  /** \brief normalized [0, 1] location to the original space */
+  inline vector<3, float> dequantize(const vector<3, float> &q) const {
+    return offset + q * scale;
+  }
+  /** \brief original location to normalized [0, 1] */
+  inline vector<3, float> quantize(const vector<3, float> &p) const {
+    return scale > 0 ? (p - offset) / scale : vector<3, float>();
+  }
+};
+
+/* converts a block of vertices to quantized form -- don't use this */
+template<typename M, typename Q>
+struct quantize_vertices_ {
+  quantize_vertices_(const M &in, Q &out, const mesh_quantization &q)
+    : in_(in), out_(out), q_(q) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    typedef typename M::const_vertex_access_t in_t;
+    typedef typename Q::vertex_access_t out_t;
+    for(std::size_t i=begin; i<end; ++i) {
+      vector<3, float> v;
+      vector<2, float> uv;
+      vertex_read_loc<in_t>()(in_.vertices(i), v);
+      vertex_write_loc<out_t>()(out_.vertices(i), q_.quantize(v));
+      vertex_read_norm<in_t>()(in_.vertices(i), v);
+      vertex_write_norm<out_t>()(out_.vertices(i), v);
+      vertex_read_uv<in_t>()(in_.vertices(i), uv);
+      vertex_write_uv<out_t>()(out_.vertices(i), uv);
+    }
+  }
+
+  const M &in_;
+  Q &out_;
+  const mesh_quantization &q_;
+};
+
+/* converts a block of quantized vertices back -- don't use this */
+template<typename Q, typename M>
+struct dequantize_vertices_ {
+  dequantize_vertices_(const Q &in, M &out, const mesh_quantization &q)
+    : in_(in), out_(out), q_(q) { }
+
+  void operator()(std::size_t, std::size_t begin, std::size_t end) {
+    typedef typename Q::const_vertex_access_t in_t;
+    typedef typename M::vertex_access_t out_t;
+    for(std::size_t i=begin; i<end; ++i) {
+      vector<3, float> v;
+      vector<2, float> uv;
+      vertex_read_loc<in_t>()(in_.vertices(i), v);
+      vertex_write_loc<out_t>()(out_.vertices(i), q_.dequantize(v));
+      vertex_read_norm<in_t>()(in_.vertices(i), v);
+      vertex_write_norm<out_t>()(out_.vertices(i), v);
+      vertex_read_uv<in_t>()(in_.vertices(i), uv);
+      vertex_write_uv<out_t>()(out_.vertices(i), uv);
+    }
+  }
+
+  const Q &in_;
+  M &out_;
+  const mesh_quantization &q_;
+};
+
+/**
+  \brief quantize a mesh's vertices against its bounding box
+  \tparam M - supports mesh concept
+  \tparam Q - supports mesh concept, e.g. mesh<quantized_vertex>
+  \param in - mesh to quantize
+  \param out - receives the quantized mesh, faces included
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+  \returns the mapping back to in's space
+ */
+template<typename M, typename Q>
+mesh_quantization quantize_mesh(const M &in, Q &out, unsigned threads = 0) {
+  typedef typename M::const_vertex_access_t access_t;
+  const int nv = in.num_vertices();
+  vector<3, float> lo, hi;
+  for(int k=0; k<3; ++k) {
+    lo(k) = nv > 0 ? std::numeric_limits<float>::max() : 0;
+    hi(k) = nv > 0 ? -std::numeric_limits<float>::max() : 0;
+  }
+  for(int i=0; i<nv; ++i) {
+    vector<3, float> v;
+    vertex_read_loc<access_t>()(in.vertices(i), v);
+    for(int k=0; k<3; ++k) {
+      lo(k) = std::min(lo(k), v(k));
+      hi(k) = std::max(hi(k), v(k));
+    }
+  }
+  mesh_quantization q;
+  q.offset = lo;
+  q.scale = std::max(hi(0) - lo(0), std::max(hi(1) - lo(1), hi(2) - lo(2)));
+
+  out.resize_vertices(nv);
+  quantize_vertices_<M, Q> quantize(in, out, q);
+  parallel_for_blocks(0, nv, quantize, 1 << 14, threads);
+  out.resize_faces(in.num_faces());
+  for(int f=0; f<in.num_faces(); ++f) {
+    for(int v=0; v<3; ++v) out.faces(f)[v] = in.faces(f)[v];
+  }
+  return q;
+}
+
+/**
+  \brief expand a quantized mesh back to full precision
+  \tparam Q - supports mesh concept, e.g. mesh<quantized_vertex>
+  \tparam M - supports mesh concept
+  \param in - quantized mesh
+  \param q - mapping returned by quantize_mesh
+  \param out - receives the expanded mesh, faces included
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+ */
+template<typename Q, typename M>
+void dequantize_mesh(const Q &in, const mesh_quantization &q, M &out,
+    unsigned threads = 0) {
+  const int nv = in.num_vertices();
+  out.resize_vertices(nv);
+  dequantize_vertices_<Q, M> dequantize(in, out, q);
+  parallel_for_blocks(0, nv, dequantize, 1 << 14, threads);
+  out.resize_faces(in.num_faces());
+  for(int f=0; f<in.num_faces(); ++f) {
+    for(int v=0; v<3; ++v) out.faces(f)[v] = in.faces(f)[v];
+  }
+}
+
+/**
+  \brief compress a mesh's index buffer
+  Each index is stored as the zigzag-encoded difference from the one
+  before it, as a little-endian base-128 varint.  After
+  optimize_vertex_cache and optimize_vertex_fetch most differences fit
+  in one byte, about a third of the size of 32-bit indices.
+  \tparam M - supports mesh concept
+  \param m - mesh whose faces are compressed
+  \param out - receives the compressed bytes
+ */
+template<typename M>
+void compress_indices(const M &m, std::vector<unsigned char> &out) {
+  out.clear();
+  out.reserve(3*m.num_faces() + 16);
+  int64_t prev = 0;
+  for(int f=0; f<m.num_faces(); ++f) {
+    for(int v=0; v<3; ++v) {
+      const int64_t index = m.faces(f)[v];
+      const int64_t delta = index - prev;
+      uint64_t zigzag = (static_cast<uint64_t>(delta) << 1)
+        ^ static_cast<uint64_t>(delta >> 63);
+      while(zigzag >= 0x80) {
+        out.push_back(static_cast<unsigned char>(zigzag | 0x80));
+        zigzag >>= 7;
+      }
+      out.push_back(static_cast<unsigned char>(zigzag));
+      prev = index;
+    }
+  }
+}
+
+/**
+  \brief decompress an index buffer written by compress_indices
+  \tparam M - supports mesh concept
+  \param data - compressed bytes
+  \param size - number of compressed bytes
+  \param m - mesh whose faces are replaced
+  \throws std::runtime_error if the data is truncated or malformed
+ */
+template<typename M>
+void decompress_indices(const unsigned char *data, std::size_t size, M &m) {
+  const unsigned char *p = data;
+  const unsigned char *end = data + size;
+  std::vector<int> indices;
+  indices.reserve(size);
+  int64_t prev = 0;
+  while(p != end) {
+    uint64_t zigzag = 0;
+    int shift = 0;
+    for(;;) {
+      if(p == end || shift > 63) {
+        throw std::runtime_error("corrupt compressed indices");
+      }
+      const unsigned char byte = *p++;
+      zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      shift += 7;
+      if(!(byte & 0x80)) break;
+    }
+    const int64_t delta = static_cast<int64_t>(zigzag >> 1)
+      ^ -static_cast<int64_t>(zigzag & 1);
+    prev += delta;
+    if(prev < 0 || prev > std::numeric_limits<int>::max()) {
+      throw std::runtime_error("corrupt compressed indices");
+    }
+    indices.push_back(static_cast<int>(prev));
+  }
+  if(indices.size() % 3 != 0) {
+    throw std::runtime_error("corrupt compressed indices");
+  }
+  m.resize_faces(indices.size() / 3);
+  for(std::size_t f=0; f<indices.size() / 3; ++f) {
+    for(int v=0; v<3; ++v) m.faces(f)[v] = indices[3*f + v];
+  }
+}
+
+}
+
+#endif
+
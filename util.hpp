@@ -8,6 +8,8 @@
 #include "util/generic_ptr_deref.hpp"
 #include "util/global.hpp"
 #include "util/int_by_size.hpp"
+#include "util/mapped_file.hpp"
+#include "util/parallel.hpp"
 
 #endif
 
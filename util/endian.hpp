@@ -62,6 +62,16 @@ inline T hton(const T &t) {
 }
 template<typename T> inline T ntoh(const T &t) { return hton(t); }
 
+/** \brief convert from host byte order to little-endian */
+template<typename T>
+inline T htol(const T &t) {
+  if(little_endian()) return t;
+  hton_recursive<sizeof(T)> rec;
+  return rec(t);
+}
+/** \brief convert from little-endian to host byte order */
+template<typename T> inline T ltoh(const T &t) { return htol(t); }
+
 }
 
 #endif
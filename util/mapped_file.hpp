@@ -0,0 +1,134 @@
+#ifndef _GHP_UTIL_MAPPED_FILE_HPP_
+#define _GHP_UTIL_MAPPED_FILE_HPP_
+
+#include <boost/noncopyable.hpp>
+
+#include <stdexcept>
+#include <string>
+
+#include <cstddef>
+
+#ifdef _WIN32
+  #define _GHP_UTIL_MAPPED_FILE_OK_
+  #include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+  #define _GHP_UTIL_MAPPED_FILE_OK_
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace ghp {
+
+#ifdef _GHP_UTIL_MAPPED_FILE_OK_
+/** \brief read-only memory mapping of an entire file
+  mapped_file maps a file into the address space so it can be parsed in
+  place without copying it through stream buffers.  The mapping is
+  released when the object is destroyed.  Empty files are allowed and
+  map to a NULL data() with size() 0.  Available on Windows and UNIX-like
+  operating systems.
+ */
+template<int N=0>
+class mapped_file_ : public boost::noncopyable {
+public:
+  /** \brief map a file
+    \param path - path of file to map
+    \throws std::runtime_error if the file can't be opened or mapped
+   */
+  mapped_file_(const std::string &path)
+      : data_(NULL),
+      size_(0) {
+    open_(path);
+  }
+  ~mapped_file_() {
+    close_();
+  }
+
+  /** \brief beginning of the mapped bytes */
+  inline const char* data() const { return data_; }
+  /** \brief one past the end of the mapped bytes */
+  inline const char* end() const { return data_ + size_; }
+  /** \brief number of mapped bytes */
+  inline std::size_t size() const { return size_; }
+
+private:
+#ifdef _WIN32
+  void open_(const std::string &path) {
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+      OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    mapping_ = NULL;
+    if(file_ == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error("couldn't open file " + path);
+    }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file_, &size)) {
+      CloseHandle(file_);
+      throw std::runtime_error("couldn't stat file " + path);
+    }
+    size_ = static_cast<std::size_t>(size.QuadPart);
+    if(size_ == 0) return;
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping_ != NULL) {
+      data_ = static_cast<const char*>(
+        MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+    if(data_ == NULL) {
+      close_();
+      throw std::runtime_error("couldn't map file " + path);
+    }
+  }
+  void close_() {
+    if(data_ != NULL) UnmapViewOfFile(data_);
+    if(mapping_ != NULL) CloseHandle(mapping_);
+    if(file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+    data_ = NULL;
+    mapping_ = NULL;
+    file_ = INVALID_HANDLE_VALUE;
+  }
+
+  HANDLE file_;
+  HANDLE mapping_;
+#else
+  void open_(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+      throw std::runtime_error("couldn't open file " + path);
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("couldn't stat file " + path);
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+    if(size_ == 0) {
+      ::close(fd);
+      return;
+    }
+    void *addr = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(addr == MAP_FAILED) {
+      size_ = 0;
+      throw std::runtime_error("couldn't map file " + path);
+    }
+    madvise(addr, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(addr);
+  }
+  void close_() {
+    if(data_ != NULL) munmap(const_cast<char*>(data_), size_);
+    data_ = NULL;
+  }
+#endif
+
+  const char *data_;
+  std::size_t size_;
+};
+
+typedef mapped_file_<0> mapped_file;
+
+#endif
+
+}
+
+#endif
+
@@ -0,0 +1,100 @@
+#ifndef _GHP_UTIL_PARALLEL_HPP_
+#define _GHP_UTIL_PARALLEL_HPP_
+
+#include <boost/bind/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+
+namespace ghp {
+
+/** \brief number of hardware threads available, never less than 1 */
+inline unsigned hardware_threads() {
+  const unsigned n = boost::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+/**
+  \brief number of blocks parallel_for_blocks will split a range into
+  \param size - number of elements in the range
+  \param min_block - smallest block worth handing to a thread
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+ */
+inline std::size_t parallel_num_blocks(std::size_t size,
+    std::size_t min_block = 1, unsigned threads = 0) {
+  if(threads == 0) threads = hardware_threads();
+  if(min_block == 0) min_block = 1;
+  const std::size_t by_size = size / min_block;
+  return std::max<std::size_t>(1, std::min<std::size_t>(threads, by_size));
+}
+
+template<typename F>
+struct parallel_block_runner_ {
+  parallel_block_runner_(F &f, std::string &error, boost::mutex &mutex)
+    : f_(f), error_(error), mutex_(mutex) { }
+
+  void operator()(std::size_t block, std::size_t begin, std::size_t end) {
+    try {
+      f_(block, begin, end);
+    } catch(const std::exception &e) {
+      boost::mutex::scoped_lock lock(mutex_);
+      if(error_.empty()) error_ = e.what();
+    } catch(...) {
+      boost::mutex::scoped_lock lock(mutex_);
+      if(error_.empty()) error_ = "unknown error in worker thread";
+    }
+  }
+
+  F &f_;
+  std::string &error_;
+  boost::mutex &mutex_;
+};
+
+/**
+  \brief split a range into contiguous blocks and process them in parallel
+  The range [begin, end) is split into parallel_num_blocks() blocks of
+  nearly equal size.  f(block, block_begin, block_end) is called once per
+  block; block 0 runs on the calling thread.  f is shared (not copied)
+  between threads, so it must tolerate concurrent calls on disjoint
+  blocks.
+  \tparam F - functor taking (std::size_t, std::size_t, std::size_t)
+  \param min_block - smallest block worth handing to a thread
+  \param threads - maximum number of threads; 0 uses hardware_threads()
+  \throws std::runtime_error if f throws on any thread
+ */
+template<typename F>
+void parallel_for_blocks(std::size_t begin, std::size_t end, F &f,
+    std::size_t min_block = 1, unsigned threads = 0) {
+  if(end <= begin) return;
+  const std::size_t size = end - begin;
+  const std::size_t blocks = parallel_num_blocks(size, min_block, threads);
+  if(blocks == 1) {
+    f(0, begin, end);
+    return;
+  }
+
+  std::string error;
+  boost::mutex mutex;
+  parallel_block_runner_<F> runner(f, error, mutex);
+  boost::thread_group group;
+  for(std::size_t b=1; b<blocks; ++b) {
+    group.create_thread(boost::bind<void>(boost::ref(runner), b,
+      begin + size*b/blocks, begin + size*(b+1)/blocks));
+  }
+  runner(0, begin, begin + size/blocks);
+  group.join_all();
+  if(!error.empty()) {
+    throw std::runtime_error(error);
+  }
+}
+
+}
+
+#endif
+